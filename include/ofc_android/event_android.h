@@ -0,0 +1,111 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons 
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_EVENT_ANDROID_H__)
+#define __OFC_EVENT_ANDROID_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup event_android Android Event Waits
+ *
+ * Waits with a deadline and waits on several events.  These save
+ * setting up a wait set, and a timer, for a short synchronous wait.
+ * Deadlines are kept on the monotonic clock so they don't move when
+ * the wall clock is set.
+ */
+
+/** \{ */
+
+/**
+ * Timeout for ofc_event_wait_any and ofc_event_wait_all that never
+ * expires
+ */
+#define OFC_EVENT_WAIT_INFINITE ((OFC_MSTIME) -1)
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Wait for an event for up to a number of milliseconds
+ *
+ * \param hEvent
+ * The event
+ *
+ * \param msec
+ * Longest time to wait in milliseconds
+ *
+ * \returns
+ * OFC_TRUE if the event was signalled, OFC_FALSE if the wait timed out.
+ * An auto reset event is reset when the wait returns OFC_TRUE.
+ */
+OFC_BOOL ofc_event_wait_timeout_impl(OFC_HANDLE hEvent, OFC_MSTIME msec);
+
+/**
+ * Wait for an event for up to a number of nanoseconds
+ *
+ * \param hEvent
+ * The event
+ *
+ * \param nsec
+ * Longest time to wait in nanoseconds
+ *
+ * \returns
+ * OFC_TRUE if the event was signalled, OFC_FALSE if the wait timed out.
+ * An auto reset event is reset when the wait returns OFC_TRUE.
+ */
+OFC_BOOL ofc_event_wait_timeout_nsec_impl(OFC_HANDLE hEvent,
+                                          OFC_UINT64 nsec);
+
+/**
+ * Wait for any of several events
+ *
+ * \param count
+ * Number of events
+ *
+ * \param events
+ * The events.  Handles that are not valid are ignored.
+ *
+ * \param msec
+ * Longest time to wait in milliseconds or OFC_EVENT_WAIT_INFINITE
+ *
+ * \returns
+ * The index of an event that was signalled, or -1 if the wait timed
+ * out.  An auto reset event is reset when it is returned.  When more
+ * than one event is signalled, the lowest index is returned.
+ */
+OFC_INT ofc_event_wait_any(OFC_INT count, OFC_HANDLE *events,
+                           OFC_MSTIME msec);
+
+/**
+ * Wait for all of several events
+ *
+ * The wait completes when every event is signalled at once.  The auto
+ * reset events among them are all reset together.
+ *
+ * \param count
+ * Number of events
+ *
+ * \param events
+ * The events.  Handles that are not valid are ignored.
+ *
+ * \param msec
+ * Longest time to wait in milliseconds or OFC_EVENT_WAIT_INFINITE
+ *
+ * \returns
+ * OFC_TRUE if the events were signalled, OFC_FALSE if the wait timed
+ * out
+ */
+OFC_BOOL ofc_event_wait_all(OFC_INT count, OFC_HANDLE *events,
+                            OFC_MSTIME msec);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
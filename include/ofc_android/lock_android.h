@@ -0,0 +1,278 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_LOCK_ANDROID_H__)
+#define __OFC_LOCK_ANDROID_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup lock_android Android Locks
+ *
+ * Android locks spin for a while before sleeping in the kernel, and
+ * keep count of how often they were contended and for how long.  The
+ * time locks are held and statistics per call site are kept only while
+ * profiling is on.  Call sites are known only when built with
+ * OFC_STACK_TRACE.
+ *
+ * Fast locks are a lighter alternative for short critical sections
+ * that are never entered twice by the same thread.  They are embedded
+ * in the structure they guard rather than allocated, and take and
+ * release with a single atomic operation when uncontended.  They are
+ * not profiled.
+ *
+ * Reader-writer locks let any number of readers in at once.  Each
+ * thread counts its reads in its own slot of the lock, so readers
+ * don't write a cache line other readers use.  Waiting writers keep
+ * new readers out.
+ */
+
+/** \{ */
+
+/**
+ * Number of histogram buckets.  Bucket zero counts times below one
+ * nanosecond, bucket n times from 2^(n-1) up to 2^n nanoseconds, and
+ * the last bucket everything longer.
+ */
+#define OFC_LOCK_STATS_BUCKETS 32
+
+/**
+ * A fast lock
+ *
+ * The field is private.
+ */
+typedef struct
+{
+  OFC_UINT32 state ;
+} OFC_FAST_LOCK ;
+
+/**
+ * Static initializer for a fast lock
+ */
+#define OFC_FAST_LOCK_INIT { 0 }
+
+/**
+ * A reader-writer lock
+ */
+typedef struct ofc_rwlock OFC_RWLOCK ;
+
+/**
+ * Lock statistics
+ */
+typedef struct
+{
+  /**
+   * The lock
+   */
+  OFC_VOID *lock ;
+  /**
+   * Where the lock was created, or OFC_NULL without OFC_STACK_TRACE
+   */
+  OFC_VOID *creator ;
+  /**
+   * Number of times the lock was taken
+   */
+  OFC_UINT64 acquired ;
+  /**
+   * Times the lock was found held and how many of those had to sleep
+   */
+  OFC_UINT64 contended ;
+  OFC_UINT64 parked ;
+  /**
+   * Total nanoseconds spent waiting and a histogram of each wait
+   */
+  OFC_UINT64 wait_nsec ;
+  OFC_UINT32 wait_hist[OFC_LOCK_STATS_BUCKETS] ;
+  /**
+   * Total nanoseconds the lock was held while profiling and a
+   * histogram of each hold
+   */
+  OFC_UINT64 hold_nsec ;
+  OFC_UINT32 hold_hist[OFC_LOCK_STATS_BUCKETS] ;
+} OFC_LOCK_STATS ;
+
+/**
+ * Statistics of a call site taking locks
+ */
+typedef struct
+{
+  /**
+   * Address of the call, relative to the process
+   */
+  OFC_VOID *caller ;
+  /**
+   * Locks taken here while profiling
+   */
+  OFC_UINT64 acquired ;
+  /**
+   * Locks found held here, total nanoseconds waited and a histogram
+   * of each wait
+   */
+  OFC_UINT64 contended ;
+  OFC_UINT64 wait_nsec ;
+  OFC_UINT32 wait_hist[OFC_LOCK_STATS_BUCKETS] ;
+  /**
+   * Total nanoseconds locks taken here were held while profiling and
+   * a histogram of each hold
+   */
+  OFC_UINT64 hold_nsec ;
+  OFC_UINT32 hold_hist[OFC_LOCK_STATS_BUCKETS] ;
+} OFC_LOCK_SITE_STATS ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Initialize a fast lock
+ *
+ * Fast locks need no destruction.
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_fast_lock_init(OFC_FAST_LOCK *lock);
+
+/**
+ * Take a fast lock
+ *
+ * The lock must not already be held by the caller.
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_fast_lock(OFC_FAST_LOCK *lock);
+
+/**
+ * Take a fast lock if it is free
+ *
+ * \param lock
+ * The lock
+ *
+ * \returns
+ * OFC_TRUE if the lock was taken
+ */
+OFC_BOOL ofc_fast_lock_try(OFC_FAST_LOCK *lock);
+
+/**
+ * Release a fast lock
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_fast_unlock(OFC_FAST_LOCK *lock);
+
+/**
+ * Create a reader-writer lock
+ *
+ * \returns
+ * The lock, or OFC_NULL if out of memory
+ */
+OFC_RWLOCK *ofc_rwlock_init(OFC_VOID);
+
+/**
+ * Destroy a reader-writer lock
+ *
+ * \param lock
+ * The lock, which must not be held
+ */
+OFC_VOID ofc_rwlock_destroy(OFC_RWLOCK *lock);
+
+/**
+ * Take a reader-writer lock for reading
+ *
+ * A thread must not take the lock for reading again while it holds it,
+ * since a waiting writer would keep it out.
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_rwlock_read(OFC_RWLOCK *lock);
+
+/**
+ * Release a reader-writer lock taken for reading
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_rwlock_read_unlock(OFC_RWLOCK *lock);
+
+/**
+ * Take a reader-writer lock for writing
+ *
+ * \param lock
+ * The lock, which the caller must not hold
+ */
+OFC_VOID ofc_rwlock_write(OFC_RWLOCK *lock);
+
+/**
+ * Release a reader-writer lock taken for writing
+ *
+ * \param lock
+ * The lock
+ */
+OFC_VOID ofc_rwlock_write_unlock(OFC_RWLOCK *lock);
+
+/**
+ * Turn profiling of hold times and call sites on or off
+ *
+ * Contention is always counted.  Profiling adds a clock read to every
+ * lock and unlock.
+ *
+ * \param enable
+ * OFC_TRUE to profile
+ */
+OFC_VOID ofc_lock_profile(OFC_BOOL enable);
+
+/**
+ * Get the statistics of the most contended locks
+ *
+ * \param stats
+ * Array to receive the statistics, most contended first
+ *
+ * \param count
+ * Number of entries in the array
+ *
+ * \returns
+ * The number of entries filled in
+ */
+OFC_INT ofc_lock_get_stats(OFC_LOCK_STATS *stats, OFC_INT count);
+
+/**
+ * Get the statistics of the most contended call sites
+ *
+ * \param stats
+ * Array to receive the statistics, most contended first
+ *
+ * \param count
+ * Number of entries in the array
+ *
+ * \returns
+ * The number of entries filled in.  This is zero without
+ * OFC_STACK_TRACE.
+ */
+OFC_INT ofc_lock_get_site_stats(OFC_LOCK_SITE_STATS *stats, OFC_INT count);
+
+/**
+ * Clear the statistics of all locks and call sites
+ */
+OFC_VOID ofc_lock_reset_stats(OFC_VOID);
+
+/**
+ * Write the statistics of the most contended locks and call sites to
+ * the log
+ *
+ * \param count
+ * Number of locks and of call sites to report
+ */
+OFC_VOID ofc_lock_log_stats(OFC_INT count);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
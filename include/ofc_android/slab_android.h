@@ -0,0 +1,139 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_SLAB_ANDROID_H__)
+#define __OFC_SLAB_ANDROID_H__
+
+#include "ofc/types.h"
+#include "ofc_android/lock_android.h"
+
+/**
+ * \defgroup slab_android Android Object Pools
+ *
+ * Pools of fixed size objects for the platform objects that are
+ * created and destroyed at high rates, such as events, locks, sockets
+ * and threads.  Objects are carved from page sized chunks that are
+ * never returned to the system.  Each thread keeps a small cache of
+ * free objects per pool, so most allocations and frees don't touch
+ * anything shared.
+ */
+
+/** \{ */
+
+/**
+ * Most pools there can be.  Pools past this work without thread caches.
+ */
+#define OFC_SLAB_MAX 16
+
+/**
+ * A pool of objects of one size
+ *
+ * Pools are declared statically with OFC_SLAB_INIT and set themselves
+ * up on first use.  The fields past size are private.
+ */
+typedef struct ofc_slab
+{
+  OFC_CCHAR *name ;
+  OFC_SIZET size ;
+  OFC_INT index ;
+  OFC_FAST_LOCK lock ;
+  OFC_VOID *free ;
+  OFC_UINT32 chunks ;
+  OFC_UINT32 live ;
+  OFC_UINT32 peak ;
+  struct ofc_slab *next ;
+} OFC_SLAB ;
+
+/**
+ * Static initializer for a pool
+ *
+ * \param name
+ * Name the pool's statistics are reported under
+ *
+ * \param size
+ * Size of the pool's objects
+ */
+#define OFC_SLAB_INIT(name, size) \
+  { (name), (size), -1, OFC_FAST_LOCK_INIT, OFC_NULL, 0, 0, 0, OFC_NULL }
+
+/**
+ * Statistics of a pool
+ */
+typedef struct
+{
+  /**
+   * The pool's name
+   */
+  OFC_CCHAR *name ;
+  /**
+   * Size of the pool's objects, rounded up to their alignment
+   */
+  OFC_SIZET size ;
+  /**
+   * Objects allocated and not freed
+   */
+  OFC_UINT32 live ;
+  /**
+   * Most objects ever allocated at once
+   */
+  OFC_UINT32 peak ;
+  /**
+   * Chunks taken from the system
+   */
+  OFC_UINT32 chunks ;
+} OFC_SLAB_STATS ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Allocate an object from a pool
+ *
+ * \param slab
+ * The pool
+ *
+ * \returns
+ * The object, uninitialized, or OFC_NULL if out of memory
+ */
+OFC_VOID *ofc_slab_alloc(OFC_SLAB *slab);
+
+/**
+ * Return an object to its pool
+ *
+ * \param slab
+ * The pool the object was allocated from
+ *
+ * \param obj
+ * The object.  Nothing is done if it is OFC_NULL.
+ */
+OFC_VOID ofc_slab_free(OFC_SLAB *slab, OFC_VOID *obj);
+
+/**
+ * Get the statistics of the pools in use
+ *
+ * \param stats
+ * Array to receive the statistics
+ *
+ * \param count
+ * Number of entries in the array
+ *
+ * \returns
+ * The number of entries filled in
+ */
+OFC_INT ofc_slab_get_stats(OFC_SLAB_STATS *stats, OFC_INT count);
+
+/**
+ * Write the statistics of the pools in use to the log
+ */
+OFC_VOID ofc_slab_log_stats(OFC_VOID);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
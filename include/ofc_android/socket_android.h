@@ -0,0 +1,118 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons 
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_SOCKET_ANDROID_H__)
+#define __OFC_SOCKET_ANDROID_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup socket_android Android Socket Watch Support
+ *
+ * A socket watch lets a wait set that has registered a socket's
+ * descriptor with the kernel hear about changes to the socket's
+ * interest mask and about the descriptor being closed.  It also lets
+ * the wait set deliver the socket's ready events without locking the
+ * socket handle.
+ *
+ * The socket keeps its own copy of the watch and calls the callbacks
+ * with that copy, without holding any lock, so a callback may run
+ * after the watch has been removed.  Callbacks find their watcher
+ * through the owner and target handles and check the serial against
+ * the one it holds.
+ */
+
+/** \{ */
+
+typedef struct ofc_socket_watch OFC_SOCKET_WATCH ;
+
+struct ofc_socket_watch
+{
+  /*
+   * Called when the socket's interest mask (poll events) changes.  The
+   * current mask is read through events, since calls made for two
+   * changes may arrive in either order.
+   */
+  OFC_VOID (*update)(OFC_SOCKET_WATCH *watch) ;
+  /*
+   * Called just before the socket's descriptor is closed or the socket
+   * is destroyed
+   */
+  OFC_VOID (*close)(OFC_SOCKET_WATCH *watch) ;
+  /*
+   * Set when the watch is installed to where the socket keeps the
+   * events it was last found ready with.  Stored to atomically, and
+   * only until the watch is removed or closed.
+   */
+  OFC_UINT16 *revents ;
+  /*
+   * Set when the watch is installed to where the socket keeps its
+   * interest mask.  Read atomically.
+   */
+  OFC_UINT16 *events ;
+  /*
+   * Set when the watch is installed.  No two watches get the same
+   * serial.
+   */
+  OFC_UINT32 serial ;
+  /*
+   * Set by the watcher for its callbacks.  The handle of the watcher
+   * and the handle it is watching the socket for.
+   */
+  OFC_HANDLE hOwner ;
+  OFC_HANDLE hTarget ;
+} ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Install a watch on a socket implementation handle
+ *
+ * \param hSocket
+ * The socket implementation handle
+ *
+ * \param watch
+ * The watch to install.  Any previous watch is replaced.  The socket
+ * keeps a copy.
+ *
+ * \param events
+ * Returns the socket's current interest mask
+ *
+ * \param old
+ * Returns a copy of the watch that was replaced, or a watch with a
+ * null close callback if there was none.  A socket is in one wait set
+ * at a time, so the caller calls the old watch's close callback to
+ * have the wait set it was in stop using it.  The callback may take
+ * that wait set's lock, so the caller must not hold other wait set
+ * locks when it does.
+ *
+ * \returns
+ * The socket's descriptor or -1 if the socket is not valid
+ */
+int ofc_socket_impl_watch(OFC_HANDLE hSocket, OFC_SOCKET_WATCH *watch,
+                          OFC_UINT16 *events, OFC_SOCKET_WATCH *old);
+
+/**
+ * Remove a watch from a socket implementation handle
+ *
+ * \param hSocket
+ * The socket implementation handle
+ *
+ * \param watch
+ * The watch to remove.  Nothing is done if it is not the installed watch.
+ * Callbacks already under way may still arrive.
+ */
+OFC_VOID ofc_socket_impl_unwatch(OFC_HANDLE hSocket,
+                                 OFC_SOCKET_WATCH *watch);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
@@ -0,0 +1,130 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_TASKPOOL_ANDROID_H__)
+#define __OFC_TASKPOOL_ANDROID_H__
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+
+/**
+ * \defgroup taskpool_android Android Task Pools
+ *
+ * A task pool runs short tasks, such as checksums, copies or batches
+ * of directory lookups, on a fixed set of worker threads rather than
+ * on a thread created for each job.  Each worker keeps its own queue
+ * of tasks and idle workers take tasks from busy ones.
+ *
+ * Tasks are submitted in groups.  A group is given an event which is
+ * set when every task submitted in the group has run, so completion
+ * can be waited for directly or through a wait set.
+ */
+
+/** \{ */
+
+/**
+ * A task pool
+ */
+typedef struct ofc_task_pool OFC_TASK_POOL ;
+
+/**
+ * A group of tasks
+ */
+typedef struct ofc_task_group OFC_TASK_GROUP ;
+
+/**
+ * A task
+ *
+ * \param context
+ * The context the task was submitted with
+ */
+typedef OFC_VOID (OFC_TASK_FN)(OFC_VOID *context) ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Create a task pool
+ *
+ * \param workers
+ * Number of worker threads, or zero for one per processor
+ *
+ * \returns
+ * The pool, or OFC_NULL if it could not be created
+ */
+OFC_TASK_POOL *ofc_task_pool_create(OFC_INT workers);
+
+/**
+ * Destroy a task pool
+ *
+ * Tasks already submitted are run before the workers exit.
+ *
+ * \param pool
+ * The pool
+ */
+OFC_VOID ofc_task_pool_destroy(OFC_TASK_POOL *pool);
+
+/**
+ * Create a group of tasks
+ *
+ * \param hEvent
+ * Event to set once the group is closed and all its tasks have run
+ *
+ * \returns
+ * The group, or OFC_NULL if out of memory
+ */
+OFC_TASK_GROUP *ofc_task_group_create(OFC_HANDLE hEvent);
+
+/**
+ * Say that no more tasks will be submitted in a group
+ *
+ * The group's event is set when its last task has run, or now if
+ * they all have.
+ *
+ * \param group
+ * The group
+ */
+OFC_VOID ofc_task_group_close(OFC_TASK_GROUP *group);
+
+/**
+ * Destroy a group of tasks
+ *
+ * \param group
+ * The group, which must have been closed and its event set
+ */
+OFC_VOID ofc_task_group_destroy(OFC_TASK_GROUP *group);
+
+/**
+ * Submit a task to a pool
+ *
+ * Tasks submitted from a worker go to that worker's own queue.  They
+ * should not block for long.
+ *
+ * \param pool
+ * The pool
+ *
+ * \param fn
+ * The task
+ *
+ * \param context
+ * Context to pass to the task
+ *
+ * \param group
+ * The group the task belongs to, which must not be closed, or OFC_NULL
+ *
+ * \returns
+ * OFC_TRUE if the task was queued
+ */
+OFC_BOOL ofc_task_submit(OFC_TASK_POOL *pool, OFC_TASK_FN *fn,
+			 OFC_VOID *context, OFC_TASK_GROUP *group);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
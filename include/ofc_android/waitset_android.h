@@ -0,0 +1,353 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons 
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_WAITSET_ANDROID_H__)
+#define __OFC_WAITSET_ANDROID_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup waitset_android Android Dependent Scheduler Handling
+ */
+
+/** \{ */
+
+/**
+ * A handle reported ready by ofc_waitset_wait_multi
+ */
+typedef struct
+{
+  /**
+   * The handle that was added to the wait set
+   */
+  OFC_HANDLE hEvent ;
+  /**
+   * Poll events for sockets and files.  Zero for other handles.
+   */
+  OFC_UINT16 revents ;
+} OFC_WAITSET_READY ;
+
+/**
+ * Dispatch priorities
+ *
+ * When several handles are ready, higher priority handles are reported
+ * first.  Lower priorities are not starved.  Each gets a turn after a
+ * few higher priority handles have gone ahead of it.
+ */
+typedef enum
+{
+  OFC_WAITSET_PRIORITY_HIGH,
+  OFC_WAITSET_PRIORITY_NORMAL,
+  OFC_WAITSET_PRIORITY_LOW,
+  OFC_WAITSET_PRIORITIES
+} OFC_WAITSET_PRIORITY ;
+
+/**
+ * A group of wait sets that share work
+ *
+ * Each wait set in a group is serviced by its own thread.  A
+ * descriptor reported by one wait set isn't reported again by any
+ * wait set in the group until its thread waits again.  A wait set with
+ * more ready handles than its thread asked for leaves the rest where a
+ * thread with nothing to do can take them.
+ */
+typedef struct ofc_waitset_group OFC_WAITSET_GROUP ;
+
+/**
+ * Handle classes counted by the wait set statistics
+ */
+typedef enum
+{
+  OFC_WAITSET_STATS_EVENT,
+  OFC_WAITSET_STATS_WAIT_QUEUE,
+  OFC_WAITSET_STATS_TIMER,
+  OFC_WAITSET_STATS_SOCKET,
+  OFC_WAITSET_STATS_FILE,
+  OFC_WAITSET_STATS_OVERLAPPED,
+  OFC_WAITSET_STATS_OTHER,
+  OFC_WAITSET_STATS_TYPES
+} OFC_WAITSET_STATS_TYPE ;
+
+/**
+ * Number of histogram buckets.  Bucket zero counts values below one,
+ * bucket n values from 2^(n-1) up to 2^n, and the last bucket
+ * everything larger.
+ */
+#define OFC_WAITSET_STATS_BUCKETS 24
+
+/**
+ * Wait set statistics
+ */
+typedef struct
+{
+  /**
+   * Number of waits
+   */
+  OFC_UINT64 waits ;
+  /**
+   * Waits that slept in the kernel, the total time they slept in
+   * microseconds and a histogram of the time in microseconds
+   */
+  OFC_UINT64 blocked ;
+  OFC_UINT64 blocked_usec ;
+  OFC_UINT32 blocked_hist[OFC_WAITSET_STATS_BUCKETS] ;
+  /**
+   * Signals seen and a histogram of microseconds from the first
+   * signal of a batch to the waiter returning
+   */
+  OFC_UINT64 signals ;
+  OFC_UINT32 signal_hist[OFC_WAITSET_STATS_BUCKETS] ;
+  /**
+   * Handles examined and a histogram of handles examined per wait
+   */
+  OFC_UINT64 scanned ;
+  OFC_UINT32 scanned_hist[OFC_WAITSET_STATS_BUCKETS] ;
+  /**
+   * Wake channel reads that reported no handle
+   */
+  OFC_UINT64 spurious ;
+  /**
+   * Waits that busy polled before sleeping and how many of those found
+   * something while polling
+   */
+  OFC_UINT64 spins ;
+  OFC_UINT64 spin_hits ;
+  /**
+   * Handles reported, by class
+   */
+  OFC_UINT64 dispatched[OFC_WAITSET_STATS_TYPES] ;
+  /**
+   * Handles taken from other wait sets in the wait set's group
+   */
+  OFC_UINT64 stolen ;
+} OFC_WAITSET_STATS ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+/**
+ * Remove a handle's registration from a wait set
+ *
+ * The Android wait set keeps handles registered with the kernel from
+ * the time they are added.  ofc_waitset_set_assoc_impl calls this when
+ * the core removes a handle from its wait set or adds it to another,
+ * so the core needs nothing more.  It may also be called directly.
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param hEvent
+ * The handle being removed
+ */
+OFC_VOID ofc_waitset_remove_impl(OFC_HANDLE hSet, OFC_HANDLE hEvent);
+
+/**
+ * Wait for handles in a wait set and report every one that is ready
+ *
+ * This behaves like ofc_waitset_wait but, rather than returning the
+ * first ready handle, fills the caller's array with as many ready
+ * handles as fit.  Socket handles have their events updated as they
+ * would by ofc_waitset_wait.
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param ready
+ * Array to receive the ready handles
+ *
+ * \param count
+ * Number of entries in the array
+ *
+ * \returns
+ * The number of entries filled in.  Zero if the wait was woken without
+ * anything becoming ready.
+ */
+OFC_INT ofc_waitset_wait_multi(OFC_HANDLE hSet, OFC_WAITSET_READY *ready,
+                               OFC_INT count);
+
+/**
+ * Report the ready handles in a wait set without waiting
+ *
+ * This behaves like ofc_waitset_wait_multi but returns immediately if
+ * nothing is ready.  It is meant for servicing a wait set that was
+ * added to another and reported ready by it.
+ *
+ * A wait set can be added to another like any other handle.  The
+ * outer wait set reports the inner one when something in it may be
+ * ready, without looking at the inner wait set's handles itself.  An
+ * inner wait set without an epoll or io_uring backend reports only
+ * timers and signalled handles, such as events and wait queues, this
+ * way.
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param ready
+ * Array to receive the ready handles
+ *
+ * \param count
+ * Number of entries in the array
+ *
+ * \returns
+ * The number of entries filled in
+ */
+OFC_INT ofc_waitset_poll_multi(OFC_HANDLE hSet, OFC_WAITSET_READY *ready,
+                               OFC_INT count);
+
+/**
+ * Post the completion of an overlapped file operation
+ *
+ * A file system calls this when i/o on an overlapped handle completes,
+ * rather than setting the overlapped handle's event.  The completion
+ * goes straight onto the queue of the wait set the overlapped handle
+ * is in and costs that wait set one wake up.  Once an overlapped
+ * handle has had a completion posted, its wait set stops testing its
+ * event and reports it only from the queue.
+ *
+ * \param hOverlapped
+ * The overlapped handle whose operation completed
+ *
+ * \returns
+ * OFC_FALSE if the overlapped handle is not in a wait set.  The file
+ * system should set the overlapped handle's event instead.
+ */
+OFC_BOOL ofc_waitset_complete(OFC_HANDLE hOverlapped);
+
+/**
+ * Set the dispatch priority of a handle in a wait set
+ *
+ * Handles are added with normal priority.  The priority lasts until the
+ * handle is removed.  A wait set with handles of differing priority
+ * gathers every ready handle on each wait and reports them over the
+ * following waits in priority order.
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param hEvent
+ * A handle that has been added to the wait set
+ *
+ * \param priority
+ * The handle's priority
+ */
+OFC_VOID ofc_waitset_set_priority(OFC_HANDLE hSet, OFC_HANDLE hEvent,
+                                  OFC_WAITSET_PRIORITY priority);
+
+/**
+ * Create a wait set group
+ *
+ * \returns
+ * The group or OFC_NULL if out of memory
+ */
+OFC_WAITSET_GROUP *ofc_waitset_group_create(OFC_VOID);
+
+/**
+ * Destroy a wait set group
+ *
+ * The wait sets in the group must be destroyed first
+ *
+ * \param group
+ * The group to destroy
+ */
+OFC_VOID ofc_waitset_group_destroy(OFC_WAITSET_GROUP *group);
+
+/**
+ * Add a wait set to a group
+ *
+ * A wait set stays in its group until it is destroyed.  Once in a
+ * group, a socket or file handle reported by a wait is not reported
+ * again until the thread that got it waits again, so it can be
+ * serviced without holding it against other threads in the group.
+ * Handles may be reported by a wait on another wait set in the group
+ * than the one they were added to.  Events, wait queues and timers
+ * are only reported by their own wait set.
+ *
+ * \param group
+ * The group to join
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \returns
+ * OFC_FALSE if the wait set is already in a group or the group is full
+ */
+OFC_BOOL ofc_waitset_group_join(OFC_WAITSET_GROUP *group, OFC_HANDLE hSet);
+
+/**
+ * Choose the wait set in a group a socket should be added to
+ *
+ * Where the platform reports it, this is the wait set for the
+ * processor that received the socket's traffic, so the connection
+ * stays on one processor.  Otherwise sockets are spread over the
+ * group's wait sets.
+ *
+ * \param group
+ * The group
+ *
+ * \param hSocket
+ * The socket
+ *
+ * \returns
+ * A wait set or OFC_HANDLE_NULL if the group is empty
+ */
+OFC_HANDLE ofc_waitset_group_select(OFC_WAITSET_GROUP *group,
+                                    OFC_HANDLE hSocket);
+
+/**
+ * Busy poll before sleeping
+ *
+ * A wait set that would sleep first polls its handles for up to the
+ * given time.  The time actually spent adapts to the traffic.  It grows
+ * while handles become ready within the window and shrinks while they
+ * don't.  This trades processor time for wake up latency and is meant
+ * for threads with a core to themselves.
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param usec
+ * Longest time to poll in microseconds.  Zero, the default, disables
+ * busy polling.
+ */
+OFC_VOID ofc_waitset_set_busy_poll(OFC_HANDLE hSet, OFC_UINT32 usec);
+
+/**
+ * Get a wait set's statistics
+ *
+ * \param hSet
+ * The wait set
+ *
+ * \param stats
+ * Receives a copy of the statistics
+ *
+ * \returns
+ * OFC_FALSE if hSet is not a wait set
+ */
+OFC_BOOL ofc_waitset_get_stats(OFC_HANDLE hSet, OFC_WAITSET_STATS *stats);
+
+/**
+ * Clear a wait set's statistics
+ *
+ * \param hSet
+ * The wait set
+ */
+OFC_VOID ofc_waitset_reset_stats(OFC_HANDLE hSet);
+
+/**
+ * Write a wait set's statistics to the log
+ *
+ * \param hSet
+ * The wait set
+ */
+OFC_VOID ofc_waitset_log_stats(OFC_HANDLE hSet);
+
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
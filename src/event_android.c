@@ -4,10 +4,12 @@
  * found in the LICENSE file.
  */
 #define _GNU_SOURCE
-#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
 #include <time.h>
-#include <sys/time.h>
 #include <errno.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "ofc/types.h"
 #include "ofc/handle.h"
@@ -17,60 +19,163 @@
 #include "ofc/impl/eventimpl.h"
 #include "ofc/impl/waitsetimpl.h"
 
+#include "ofc_android/event_android.h"
+#include "ofc_android/lock_android.h"
+#include "ofc_android/slab_android.h"
+
+/*
+ * Bits of an event's state word.  The word doubles as the futex that
+ * waiters sleep on, and a setter makes the wake call only if a waiter
+ * has said it may be asleep.  The bits above count the threads waiting
+ * on the event among others, so a setter looks at the waiter list only
+ * when there is one.
+ */
+#define ANDROID_EVENT_SIGNALLED 0x01
+#define ANDROID_EVENT_WAITERS 0x02
+#define ANDROID_EVENT_MULTI 0x04
+
+/*
+ * A thread waiting on several events sleeps on its own sequence word,
+ * which is bumped when one of its events is set
+ */
 typedef struct
+{
+  OFC_UINT32 seq ;
+} ANDROID_EVENT_WAITER ;
+
+typedef struct android_event ANDROID_EVENT ;
+
+/*
+ * Links a multiple waiter into the waiter list of one of its events
+ */
+typedef struct android_event_link ANDROID_EVENT_LINK ;
+struct android_event_link
+{
+  ANDROID_EVENT *event ;
+  ANDROID_EVENT_WAITER *waiter ;
+  ANDROID_EVENT_LINK *next ;
+} ;
+
+struct android_event
 {
   OFC_EVENT_TYPE eventType ;
-  OFC_BOOL signalled ;
-  pthread_cond_t pthread_cond ;
-  pthread_mutex_t pthread_mutex ;
-  pthread_mutexattr_t pthread_mutexattr ;
-} ANDROID_EVENT ;
+  OFC_UINT32 state ;
+  /*
+   * Guards the list of multiple waiters
+   */
+  OFC_FAST_LOCK lock ;
+  ANDROID_EVENT_LINK *waiters ;
+} ;
+
+static OFC_SLAB android_event_slab =
+  OFC_SLAB_INIT ("event", sizeof (ANDROID_EVENT)) ;
+
+/*
+ * Sleep while the state word holds value.  The deadline is absolute on
+ * the monotonic clock, or NULL to sleep until woken.  Returns OFC_FALSE
+ * once the deadline has passed.
+ */
+static OFC_BOOL android_event_sleep(OFC_UINT32 *state, OFC_UINT32 value,
+				    const struct timespec *deadline)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_TRUE ;
+  if (syscall (SYS_futex, state, FUTEX_WAIT_BITSET_PRIVATE, value,
+	       deadline, NULL, FUTEX_BITSET_MATCH_ANY) == -1 &&
+      errno == ETIMEDOUT)
+    ret = OFC_FALSE ;
+  return (ret) ;
+}
+
+static OFC_VOID android_event_wake(OFC_UINT32 *state)
+{
+  syscall (SYS_futex, state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0) ;
+}
 
 OFC_HANDLE ofc_event_create_impl(OFC_EVENT_TYPE eventType)
 {
   ANDROID_EVENT *android_event ;
   OFC_HANDLE hAndroidEvent ;
-  pthread_cond_t pthread_cond_initializer = PTHREAD_COND_INITIALIZER ;
-  pthread_mutex_t pthread_mutex_initializer = PTHREAD_MUTEX_INITIALIZER ;
 
   hAndroidEvent = OFC_HANDLE_NULL ;
-  android_event = ofc_malloc(sizeof (ANDROID_EVENT)) ;
+  android_event = ofc_slab_alloc (&android_event_slab) ;
   if (android_event != OFC_NULL)
     {
       android_event->eventType = eventType ;
-      android_event->signalled = OFC_FALSE ;
-      android_event->pthread_cond = pthread_cond_initializer ;
-      android_event->pthread_mutex = pthread_mutex_initializer ;
-      pthread_mutexattr_init (&android_event->pthread_mutexattr) ;
-      pthread_mutexattr_settype (&android_event->pthread_mutexattr, 
-				 PTHREAD_MUTEX_ERRORCHECK) ;
-      pthread_cond_init (&android_event->pthread_cond, NULL)  ;
-      pthread_mutex_init (&android_event->pthread_mutex, 
-			  &android_event->pthread_mutexattr) ;
+      android_event->state = 0 ;
+      ofc_fast_lock_init (&android_event->lock) ;
+      android_event->waiters = OFC_NULL ;
       hAndroidEvent = ofc_handle_create (OFC_HANDLE_EVENT, android_event) ;
     }
   return (hAndroidEvent) ;
 }
 
-OFC_VOID ofc_event_set_impl(OFC_HANDLE hEvent)
+/*
+ * Returns whether the event was already signalled
+ */
+static OFC_BOOL android_event_signal(ANDROID_EVENT *androidEvent)
 {
-  ANDROID_EVENT *androidEvent ;
-  OFC_HANDLE hWaitSet ;
+  ANDROID_EVENT_LINK *link ;
+  OFC_UINT32 state ;
 
-  androidEvent = ofc_handle_lock(hEvent) ;
-  if (androidEvent != OFC_NULL)
+  state = __atomic_fetch_or (&androidEvent->state,
+			     ANDROID_EVENT_SIGNALLED, __ATOMIC_SEQ_CST) ;
+  if (state & ANDROID_EVENT_WAITERS)
+    {
+      /*
+       * Waiters that find the event taken say so again before going
+       * back to sleep
+       */
+      __atomic_fetch_and (&androidEvent->state, ~ANDROID_EVENT_WAITERS,
+			  __ATOMIC_SEQ_CST) ;
+      android_event_wake(&androidEvent->state) ;
+    }
+  if (state >= ANDROID_EVENT_MULTI)
     {
-      pthread_mutex_lock (&androidEvent->pthread_mutex) ;
+      /*
+       * Only the threads waiting on this event are woken
+       */
+      ofc_fast_lock (&androidEvent->lock) ;
+      for (link = androidEvent->waiters ; link != OFC_NULL ;
+	   link = link->next)
+	{
+	  __atomic_fetch_add (&link->waiter->seq, 1, __ATOMIC_SEQ_CST) ;
+	  android_event_wake(&link->waiter->seq) ;
+	}
+      ofc_fast_unlock (&androidEvent->lock) ;
+    }
+  return ((state & ANDROID_EVENT_SIGNALLED) ? OFC_TRUE : OFC_FALSE) ;
+}
+
+/*
+ * Called with the event's handle locked
+ */
+static OFC_VOID android_event_set(OFC_HANDLE hEvent,
+				  ANDROID_EVENT *androidEvent)
+{
+  OFC_HANDLE hWaitSet ;
 
-      androidEvent->signalled = OFC_TRUE ;
-      pthread_cond_broadcast (&androidEvent->pthread_cond) ;
-      
+  /*
+   * A wait set has already been told about an event that was
+   * signalled.  It clears the event when it takes it.
+   */
+  if (!android_event_signal(androidEvent))
+    {
       hWaitSet = ofc_handle_get_wait_set (hEvent) ;
-      if (hWaitSet != OFC_HANDLE_NULL) {
+      if (hWaitSet != OFC_HANDLE_NULL)
 	ofc_waitset_signal_impl (hWaitSet, hEvent) ;
-      }
-      pthread_mutex_unlock (&androidEvent->pthread_mutex) ;
+    }
+}
 
+OFC_VOID ofc_event_set_impl(OFC_HANDLE hEvent)
+{
+  ANDROID_EVENT *androidEvent ;
+
+  androidEvent = ofc_handle_lock(hEvent) ;
+  if (androidEvent != OFC_NULL)
+    {
+      android_event_set(hEvent, androidEvent) ;
       ofc_handle_unlock(hEvent) ;
     }
 }
@@ -82,9 +187,8 @@ OFC_VOID ofc_event_reset_impl(OFC_HANDLE hEvent)
   androidEvent = ofc_handle_lock(hEvent) ;
   if (androidEvent != OFC_NULL)
     {
-      pthread_mutex_lock (&androidEvent->pthread_mutex) ;
-      androidEvent->signalled = OFC_FALSE ;
-      pthread_mutex_unlock (&androidEvent->pthread_mutex) ;
+      __atomic_fetch_and (&androidEvent->state, ~ANDROID_EVENT_SIGNALLED,
+			  __ATOMIC_SEQ_CST) ;
       ofc_handle_unlock(hEvent) ;
     }
 }
@@ -110,15 +214,96 @@ OFC_VOID ofc_event_destroy_impl(OFC_HANDLE hEvent)
   androidEvent = ofc_handle_lock(hEvent) ;
   if (androidEvent != OFC_NULL)
     {
-      pthread_cond_destroy (&androidEvent->pthread_cond) ;
-      pthread_mutex_destroy (&androidEvent->pthread_mutex) ;
-      pthread_mutexattr_destroy (&androidEvent->pthread_mutexattr) ;
-      ofc_free(androidEvent) ;
+      ofc_slab_free (&android_event_slab, androidEvent) ;
       ofc_handle_destroy(hEvent) ;
       ofc_handle_unlock(hEvent) ;
     }
 }
 
+static OFC_VOID android_event_deadline(struct timespec *deadline,
+				       OFC_UINT64 nsec)
+{
+  clock_gettime (CLOCK_MONOTONIC, deadline) ;
+  deadline->tv_sec += nsec / 1000000000 ;
+  deadline->tv_nsec += nsec % 1000000000 ;
+  if (deadline->tv_nsec >= 1000000000)
+    {
+      deadline->tv_sec++ ;
+      deadline->tv_nsec -= 1000000000 ;
+    }
+}
+
+/*
+ * Consume an event if it is signalled
+ */
+static OFC_BOOL android_event_take(ANDROID_EVENT *android_event)
+{
+  OFC_UINT32 state ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  state = __atomic_load_n (&android_event->state, __ATOMIC_SEQ_CST) ;
+  while (!ret && (state & ANDROID_EVENT_SIGNALLED))
+    {
+      if (android_event->eventType != OFC_EVENT_AUTO ||
+	  __atomic_compare_exchange_n (&android_event->state, &state,
+				       state & ~ANDROID_EVENT_SIGNALLED,
+				       OFC_FALSE, __ATOMIC_SEQ_CST,
+				       __ATOMIC_SEQ_CST))
+	ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Wait for an event until the deadline, if there is one.  Returns
+ * whether the event was signalled.
+ */
+static OFC_BOOL android_event_wait(ANDROID_EVENT *android_event,
+				   const struct timespec *deadline)
+{
+  OFC_UINT32 state ;
+  OFC_BOOL done ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  done = OFC_FALSE ;
+  state = __atomic_load_n (&android_event->state, __ATOMIC_SEQ_CST) ;
+  while (!done)
+    {
+      if (state & ANDROID_EVENT_SIGNALLED)
+	{
+	  /*
+	   * An auto reset event lets one waiter through per set
+	   */
+	  if (android_event->eventType != OFC_EVENT_AUTO ||
+	      __atomic_compare_exchange_n (&android_event->state, &state,
+					   state & ~ANDROID_EVENT_SIGNALLED,
+					   OFC_FALSE, __ATOMIC_SEQ_CST,
+					   __ATOMIC_SEQ_CST))
+	    {
+	      ret = OFC_TRUE ;
+	      done = OFC_TRUE ;
+	    }
+	}
+      else if (state & ANDROID_EVENT_WAITERS ||
+	       __atomic_compare_exchange_n (&android_event->state, &state,
+					    state | ANDROID_EVENT_WAITERS,
+					    OFC_FALSE, __ATOMIC_SEQ_CST,
+					    __ATOMIC_SEQ_CST))
+	{
+	  /*
+	   * Returns at once if the event was set since we looked
+	   */
+	  if (!android_event_sleep(&android_event->state,
+				   state | ANDROID_EVENT_WAITERS, deadline))
+	    done = OFC_TRUE ;
+	  state = __atomic_load_n (&android_event->state, __ATOMIC_SEQ_CST) ;
+	}
+    }
+  return (ret) ;
+}
+
 OFC_VOID ofc_event_wait_impl(OFC_HANDLE hEvent) 
 {
   ANDROID_EVENT *android_event ;
@@ -126,16 +311,187 @@ OFC_VOID ofc_event_wait_impl(OFC_HANDLE hEvent)
   android_event = ofc_handle_lock(hEvent) ;
   if (android_event != OFC_NULL)
     {
-      pthread_mutex_lock (&android_event->pthread_mutex) ;
-      if (!android_event->signalled)
-	pthread_cond_wait (&android_event->pthread_cond,
-			   &android_event->pthread_mutex) ;
-      if (android_event->eventType == OFC_EVENT_AUTO)
-	android_event->signalled = OFC_FALSE ;
+      android_event_wait(android_event, NULL) ;
+      ofc_handle_unlock(hEvent) ;
+    }
+}
 
-      pthread_mutex_unlock (&android_event->pthread_mutex) ;
+OFC_BOOL ofc_event_wait_timeout_nsec_impl(OFC_HANDLE hEvent, OFC_UINT64 nsec)
+{
+  ANDROID_EVENT *android_event ;
+  struct timespec deadline ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  android_event = ofc_handle_lock(hEvent) ;
+  if (android_event != OFC_NULL)
+    {
+      android_event_deadline(&deadline, nsec) ;
+      ret = android_event_wait(android_event, &deadline) ;
       ofc_handle_unlock(hEvent) ;
     }
+  return (ret) ;
+}
+
+OFC_BOOL ofc_event_wait_timeout_impl(OFC_HANDLE hEvent, OFC_MSTIME msec)
+{
+  return (ofc_event_wait_timeout_nsec_impl(hEvent,
+					   (OFC_UINT64) msec * 1000000)) ;
+}
+
+/*
+ * Link a multiple waiter into an event's waiter list, and take it out
+ * again
+ */
+static OFC_VOID android_event_link(ANDROID_EVENT_LINK *link)
+{
+  ofc_fast_lock (&link->event->lock) ;
+  link->next = link->event->waiters ;
+  link->event->waiters = link ;
+  __atomic_fetch_add (&link->event->state, ANDROID_EVENT_MULTI,
+		      __ATOMIC_SEQ_CST) ;
+  ofc_fast_unlock (&link->event->lock) ;
+}
+
+static OFC_VOID android_event_unlink(ANDROID_EVENT_LINK *link)
+{
+  ANDROID_EVENT_LINK **prev ;
+
+  ofc_fast_lock (&link->event->lock) ;
+  for (prev = &link->event->waiters ; *prev != link ;
+       prev = &(*prev)->next) ;
+  *prev = link->next ;
+  __atomic_fetch_sub (&link->event->state, ANDROID_EVENT_MULTI,
+		      __ATOMIC_SEQ_CST) ;
+  ofc_fast_unlock (&link->event->lock) ;
+}
+
+/*
+ * Common body of ofc_event_wait_any and ofc_event_wait_all.  We are
+ * linked into the waiter list of each event for the duration, so
+ * setting one of them bumps the sequence we sleep on.  Reading the
+ * sequence before looking at the events means a set we miss can't
+ * let us sleep.
+ */
+static OFC_INT android_event_wait_multi(OFC_INT count, OFC_HANDLE *events,
+					OFC_MSTIME msec, OFC_BOOL all)
+{
+  ANDROID_EVENT_WAITER waiter ;
+  ANDROID_EVENT_LINK *links ;
+  ANDROID_EVENT_LINK stack_links[8] ;
+  struct timespec deadline ;
+  struct timespec *when ;
+  OFC_UINT32 seq ;
+  OFC_INT index ;
+  OFC_INT taken ;
+  OFC_INT ret ;
+  OFC_BOOL done ;
+
+  ret = -1 ;
+  if (count <= 0)
+    return (ret) ;
+  links = stack_links ;
+  if (count > 8)
+    links = ofc_malloc (sizeof (ANDROID_EVENT_LINK) * count) ;
+  if (links == OFC_NULL)
+    return (ret) ;
+
+  when = OFC_NULL ;
+  if (msec != OFC_EVENT_WAIT_INFINITE)
+    {
+      android_event_deadline(&deadline, (OFC_UINT64) msec * 1000000) ;
+      when = &deadline ;
+    }
+
+  waiter.seq = 0 ;
+  for (index = 0 ; index < count ; index++)
+    {
+      links[index].event = ofc_handle_lock(events[index]) ;
+      links[index].waiter = &waiter ;
+      if (links[index].event != OFC_NULL)
+	android_event_link(&links[index]) ;
+    }
+
+  done = OFC_FALSE ;
+  while (!done)
+    {
+      seq = __atomic_load_n (&waiter.seq, __ATOMIC_SEQ_CST) ;
+      if (!all)
+	{
+	  for (index = 0 ; index < count && ret == -1 ; index++)
+	    {
+	      if (links[index].event != OFC_NULL &&
+		  android_event_take(links[index].event))
+		ret = index ;
+	    }
+	}
+      else
+	{
+	  for (index = 0 ;
+	       index < count &&
+		 (links[index].event == OFC_NULL ||
+		  (__atomic_load_n (&links[index].event->state,
+				    __ATOMIC_SEQ_CST) &
+		   ANDROID_EVENT_SIGNALLED)) ;
+	       index++) ;
+	  if (index == count)
+	    {
+	      /*
+	       * Everything is signalled.  Take them all, or give back
+	       * what we took if another thread got in first.  Giving
+	       * one back sets it again, so a wait set it is in hears of
+	       * it.
+	       */
+	      for (taken = 0 ;
+		   taken < count &&
+		     (links[taken].event == OFC_NULL ||
+		      android_event_take(links[taken].event)) ;
+		   taken++) ;
+	      if (taken == count)
+		ret = 0 ;
+	      else
+		{
+		  while (taken > 0)
+		    {
+		      taken-- ;
+		      if (links[taken].event != OFC_NULL &&
+			  links[taken].event->eventType == OFC_EVENT_AUTO)
+			android_event_set(events[taken], links[taken].event) ;
+		    }
+		}
+	    }
+	}
+
+      if (ret != -1)
+	done = OFC_TRUE ;
+      else if (!android_event_sleep(&waiter.seq, seq, when))
+	done = OFC_TRUE ;
+    }
+
+  for (index = 0 ; index < count ; index++)
+    {
+      if (links[index].event != OFC_NULL)
+	{
+	  android_event_unlink(&links[index]) ;
+	  ofc_handle_unlock(events[index]) ;
+	}
+    }
+  if (links != stack_links)
+    ofc_free (links) ;
+
+  return (ret) ;
+}
+
+OFC_INT ofc_event_wait_any(OFC_INT count, OFC_HANDLE *events,
+                           OFC_MSTIME msec)
+{
+  return (android_event_wait_multi(count, events, msec, OFC_FALSE)) ;
+}
+
+OFC_BOOL ofc_event_wait_all(OFC_INT count, OFC_HANDLE *events,
+                            OFC_MSTIME msec)
+{
+  return (android_event_wait_multi(count, events, msec, OFC_TRUE) == 0) ;
 }
 
 OFC_BOOL ofc_event_test_impl(OFC_HANDLE hEvent)
@@ -147,9 +503,8 @@ OFC_BOOL ofc_event_test_impl(OFC_HANDLE hEvent)
   android_event = ofc_handle_lock(hEvent) ;
   if (android_event != OFC_NULL)
     {
-      pthread_mutex_lock (&android_event->pthread_mutex) ;
-      ret = android_event->signalled ;
-      pthread_mutex_unlock (&android_event->pthread_mutex) ;
+      ret = (__atomic_load_n (&android_event->state, __ATOMIC_SEQ_CST) &
+	     ANDROID_EVENT_SIGNALLED) ? OFC_TRUE : OFC_FALSE ;
       ofc_handle_unlock(hEvent) ;
     }
   return (ret) ;
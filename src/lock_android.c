@@ -1,72 +1,895 @@
 /* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
- * Use of this source code is governed by a Creative Commons 
+ * Use of this source code is governed by a Creative Commons
  * Attribution-NoDerivatives 4.0 International license that can be
  * found in the LICENSE file.
  */
-#define __USE_UNIX98
-#include <pthread.h>
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "ofc/types.h"
 #include "ofc/lock.h"
 #include "ofc/heap.h"
+#include "ofc/libc.h"
 #include "ofc/process.h"
+#include "ofc/impl/consoleimpl.h"
 
-typedef struct
+#include "ofc_android/lock_android.h"
+#include "ofc_android/slab_android.h"
+
+/*
+ * A lock's futex word holds the owner's thread id, or zero when the
+ * lock is free, and a bit saying threads may be asleep on it.  Thread
+ * ids don't reach the bit, the same as with FUTEX_WAITERS.
+ */
+#define ANDROID_LOCK_FREE 0
+#define ANDROID_LOCK_SLEEPERS 0x80000000U
+/*
+ * Bounds of the number of times a thread checks a held lock before it
+ * sleeps.  The count grows while spinning pays off and shrinks while
+ * it doesn't.
+ */
+#define ANDROID_LOCK_SPIN_MIN 16
+#define ANDROID_LOCK_SPIN_MAX 2048
+/*
+ * Call sites tracked.  A power of two.
+ */
+#define ANDROID_LOCK_SITES 512
+/*
+ * States of a fast lock.  Fast locks spin a fixed number of times.
+ */
+#define ANDROID_FAST_LOCK_FREE 0
+#define ANDROID_FAST_LOCK_HELD 1
+#define ANDROID_FAST_LOCK_SLEEPERS 2
+#define ANDROID_FAST_LOCK_SPIN 100
+/*
+ * Reader slots of a reader-writer lock, each on its own cache line.
+ * Threads are given slots in turn.
+ */
+#define ANDROID_RWLOCK_SLOTS 16
+#define ANDROID_CACHE_LINE 64
+
+typedef struct ofc_lock_impl
 {
+  OFC_UINT32 state ;
+  OFC_UINT32 depth ;
+  OFC_UINT32 spin ;
   OFC_VOID *caller ;
-  OFC_UINT32 thread ;
-  pthread_mutexattr_t mutex_attr ;
-  pthread_mutex_t mutex_lock ;
+  OFC_VOID *site ;
+  OFC_UINT64 held_at ;
+  OFC_LOCK_STATS stats ;
+  struct ofc_lock_impl *next ;
+  struct ofc_lock_impl *prev ;
 } OFC_LOCK_IMPL ;
 
+static OFC_SLAB android_lock_slab =
+  OFC_SLAB_INIT ("lock", sizeof (OFC_LOCK_IMPL)) ;
+
+typedef struct
+{
+  OFC_UINT32 readers ;
+} __attribute__((aligned (ANDROID_CACHE_LINE))) ANDROID_RWLOCK_SLOT ;
+
+struct ofc_rwlock
+{
+  ANDROID_RWLOCK_SLOT slots[ANDROID_RWLOCK_SLOTS] ;
+  /*
+   * Writers waiting or writing.  Readers kept out sleep on gate, which
+   * moves each time the last writer leaves.
+   */
+  OFC_UINT32 writers __attribute__((aligned (ANDROID_CACHE_LINE))) ;
+  OFC_UINT32 gate ;
+  OFC_UINT32 readers_asleep ;
+  /*
+   * Moved by readers leaving while there are writers.  The writer
+   * waiting for readers to leave sleeps on it.
+   */
+  OFC_UINT32 drained ;
+  OFC_UINT32 writer_asleep ;
+  OFC_FAST_LOCK write_lock ;
+} ;
+
+/*
+ * The lock's size is a multiple of a cache line and chunks are page
+ * aligned, so the slots of every lock in the pool are line aligned
+ */
+static OFC_SLAB android_rwlock_slab =
+  OFC_SLAB_INIT ("rwlock", sizeof (struct ofc_rwlock)) ;
+static OFC_UINT32 android_rwlock_next_slot ;
+static __thread OFC_INT android_rwlock_slot = -1 ;
+
+/*
+ * All locks, so the most contended can be found
+ */
+static OFC_FAST_LOCK android_lock_list_lock = OFC_FAST_LOCK_INIT ;
+static OFC_LOCK_IMPL *android_lock_list ;
+
+static OFC_BOOL android_lock_profiling ;
+static OFC_INT android_lock_spin_max = -1 ;
+static __thread OFC_UINT32 android_lock_tid ;
+
+#if defined(OFC_STACK_TRACE)
+static OFC_LOCK_SITE_STATS android_lock_sites[ANDROID_LOCK_SITES] ;
+#endif
+
+static OFC_UINT32 android_lock_self(OFC_VOID)
+{
+  if (android_lock_tid == 0)
+    android_lock_tid = syscall (SYS_gettid) ;
+  return (android_lock_tid) ;
+}
+
+static OFC_UINT64 android_lock_clock(OFC_VOID)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+  return ((OFC_UINT64) ts.tv_sec * 1000000000 + ts.tv_nsec) ;
+}
+
+static OFC_VOID android_lock_relax(OFC_VOID)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause () ;
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__ ("yield") ;
+#endif
+}
+
+/*
+ * Statistics are read by other threads while the owner updates them.
+ * Plain loads and stores are enough for the owner but they have to be
+ * single copy atomic.
+ */
+static OFC_VOID android_lock_add(OFC_UINT64 *counter, OFC_UINT64 value)
+{
+  __atomic_store_n (counter,
+		    __atomic_load_n (counter, __ATOMIC_RELAXED) + value,
+		    __ATOMIC_RELAXED) ;
+}
+
+static OFC_INT android_lock_bucket(OFC_UINT64 value)
+{
+  OFC_INT bucket ;
+
+  bucket = 0 ;
+  if (value != 0)
+    bucket = 64 - __builtin_clzll (value) ;
+  if (bucket > OFC_LOCK_STATS_BUCKETS - 1)
+    bucket = OFC_LOCK_STATS_BUCKETS - 1 ;
+  return (bucket) ;
+}
+
+static OFC_VOID android_lock_hist(OFC_UINT32 *hist, OFC_UINT64 value)
+{
+  OFC_INT bucket ;
+
+  bucket = android_lock_bucket (value) ;
+  __atomic_store_n (&hist[bucket],
+		    __atomic_load_n (&hist[bucket], __ATOMIC_RELAXED) + 1,
+		    __ATOMIC_RELAXED) ;
+}
+
+#if defined(OFC_STACK_TRACE)
+/*
+ * Find or claim a call site's slot.  Returns OFC_NULL once the table
+ * is full.
+ */
+static OFC_LOCK_SITE_STATS *android_lock_site(OFC_VOID *caller)
+{
+  OFC_LOCK_SITE_STATS *site ;
+  OFC_VOID *key ;
+  OFC_UINT32 i ;
+  OFC_UINT32 probe ;
+
+  if (caller == OFC_NULL)
+    return (OFC_NULL) ;
+
+  i = ((OFC_SIZET) caller >> 2) * 2654435761U ;
+  for (probe = 0 ; probe < ANDROID_LOCK_SITES ; probe++, i++)
+    {
+      site = &android_lock_sites[i & (ANDROID_LOCK_SITES - 1)] ;
+      key = __atomic_load_n (&site->caller, __ATOMIC_ACQUIRE) ;
+      if (key == OFC_NULL)
+	{
+	  if (__atomic_compare_exchange_n (&site->caller, &key, caller,
+					   OFC_FALSE, __ATOMIC_ACQ_REL,
+					   __ATOMIC_ACQUIRE))
+	    return (site) ;
+	}
+      if (key == caller)
+	return (site) ;
+    }
+  return (OFC_NULL) ;
+}
+#endif
+
+static OFC_VOID android_lock_site_acquired(OFC_VOID *caller)
+{
+#if defined(OFC_STACK_TRACE)
+  OFC_LOCK_SITE_STATS *site ;
+
+  site = android_lock_site (caller) ;
+  if (site != OFC_NULL)
+    __atomic_add_fetch (&site->acquired, 1, __ATOMIC_RELAXED) ;
+#endif
+}
+
+static OFC_VOID android_lock_site_waited(OFC_VOID *caller, OFC_UINT64 wait)
+{
+#if defined(OFC_STACK_TRACE)
+  OFC_LOCK_SITE_STATS *site ;
+
+  site = android_lock_site (caller) ;
+  if (site != OFC_NULL)
+    {
+      __atomic_add_fetch (&site->contended, 1, __ATOMIC_RELAXED) ;
+      __atomic_add_fetch (&site->wait_nsec, wait, __ATOMIC_RELAXED) ;
+      __atomic_add_fetch (&site->wait_hist[android_lock_bucket (wait)], 1,
+			  __ATOMIC_RELAXED) ;
+    }
+#endif
+}
+
+static OFC_VOID android_lock_site_held(OFC_VOID *caller, OFC_UINT64 hold)
+{
+#if defined(OFC_STACK_TRACE)
+  OFC_LOCK_SITE_STATS *site ;
+
+  site = android_lock_site (caller) ;
+  if (site != OFC_NULL)
+    {
+      __atomic_add_fetch (&site->hold_nsec, hold, __ATOMIC_RELAXED) ;
+      __atomic_add_fetch (&site->hold_hist[android_lock_bucket (hold)], 1,
+			  __ATOMIC_RELAXED) ;
+    }
+#endif
+}
+
+static OFC_VOID android_lock_spin_init(OFC_VOID)
+{
+  /*
+   * Spinning can't help when the holder can't run at the same time
+   */
+  if (__atomic_load_n (&android_lock_spin_max, __ATOMIC_RELAXED) < 0)
+    __atomic_store_n (&android_lock_spin_max,
+		      sysconf (_SC_NPROCESSORS_CONF) > 1 ?
+		      ANDROID_LOCK_SPIN_MAX : 0, __ATOMIC_RELAXED) ;
+}
+
+/*
+ * Record that the caller now owns the lock
+ */
+static OFC_VOID android_lock_owned(OFC_LOCK_IMPL *lock, OFC_VOID *site)
+{
+  lock->depth = 1 ;
+  lock->site = site ;
+  android_lock_add (&lock->stats.acquired, 1) ;
+  lock->held_at = 0 ;
+  if (__atomic_load_n (&android_lock_profiling, __ATOMIC_RELAXED))
+    {
+      lock->held_at = android_lock_clock () ;
+      android_lock_site_acquired (site) ;
+    }
+}
+
+static OFC_VOID android_lock_contended(OFC_LOCK_IMPL *lock,
+				       OFC_UINT32 self, OFC_VOID *site)
+{
+  OFC_UINT64 start ;
+  OFC_UINT64 wait ;
+  OFC_UINT32 budget ;
+  OFC_UINT32 i ;
+  OFC_UINT32 state ;
+  OFC_BOOL parked ;
+
+  start = android_lock_clock () ;
+  budget = __atomic_load_n (&lock->spin, __ATOMIC_RELAXED) ;
+  parked = OFC_TRUE ;
+  for (i = 0 ; i < budget && parked ; i++)
+    {
+      android_lock_relax () ;
+      state = __atomic_load_n (&lock->state, __ATOMIC_RELAXED) ;
+      if (state == ANDROID_LOCK_FREE &&
+	  __atomic_compare_exchange_n (&lock->state, &state, self, OFC_FALSE,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	parked = OFC_FALSE ;
+    }
+
+  if (parked)
+    {
+      /*
+       * A thread that has slept takes the lock with the sleepers bit
+       * set since it can't know whether others are still asleep
+       */
+      state = __atomic_load_n (&lock->state, __ATOMIC_RELAXED) ;
+      for (;;)
+	{
+	  if (state == ANDROID_LOCK_FREE)
+	    {
+	      if (__atomic_compare_exchange_n (&lock->state, &state,
+					       self | ANDROID_LOCK_SLEEPERS,
+					       OFC_FALSE, __ATOMIC_ACQUIRE,
+					       __ATOMIC_RELAXED))
+		break ;
+	    }
+	  else if ((state & ANDROID_LOCK_SLEEPERS) ||
+		   __atomic_compare_exchange_n (&lock->state, &state,
+						state | ANDROID_LOCK_SLEEPERS,
+						OFC_FALSE, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+	    {
+	      syscall (SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE,
+		       state | ANDROID_LOCK_SLEEPERS, NULL, NULL, 0) ;
+	      state = __atomic_load_n (&lock->state, __ATOMIC_RELAXED) ;
+	    }
+	}
+    }
+
+  /*
+   * Same as the wait set's busy poll window.  Grow when spinning got
+   * the lock and shrink when it didn't.
+   */
+  if (!parked)
+    budget = budget * 2 ;
+  else
+    budget = budget / 2 ;
+  if (budget < ANDROID_LOCK_SPIN_MIN)
+    budget = ANDROID_LOCK_SPIN_MIN ;
+  if (budget > (OFC_UINT32) android_lock_spin_max)
+    budget = android_lock_spin_max ;
+  __atomic_store_n (&lock->spin, budget, __ATOMIC_RELAXED) ;
+
+  android_lock_owned (lock, site) ;
+
+  wait = android_lock_clock () - start ;
+  android_lock_add (&lock->stats.contended, 1) ;
+  if (parked)
+    android_lock_add (&lock->stats.parked, 1) ;
+  android_lock_add (&lock->stats.wait_nsec, wait) ;
+  android_lock_hist (lock->stats.wait_hist, wait) ;
+  android_lock_site_waited (site, wait) ;
+}
+
+OFC_VOID ofc_fast_lock_init(OFC_FAST_LOCK *lock)
+{
+  lock->state = ANDROID_FAST_LOCK_FREE ;
+}
+
+static OFC_VOID android_fast_lock_contended(OFC_FAST_LOCK *lock)
+{
+  OFC_UINT32 state ;
+  OFC_INT i ;
+
+  android_lock_spin_init () ;
+  if (android_lock_spin_max > 0)
+    {
+      for (i = 0 ; i < ANDROID_FAST_LOCK_SPIN ; i++)
+	{
+	  android_lock_relax () ;
+	  state = __atomic_load_n (&lock->state, __ATOMIC_RELAXED) ;
+	  if (state == ANDROID_FAST_LOCK_FREE &&
+	      __atomic_compare_exchange_n (&lock->state, &state,
+					   ANDROID_FAST_LOCK_HELD, OFC_FALSE,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    return ;
+	}
+    }
+
+  while (__atomic_exchange_n (&lock->state, ANDROID_FAST_LOCK_SLEEPERS,
+			      __ATOMIC_ACQUIRE) != ANDROID_FAST_LOCK_FREE)
+    syscall (SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE,
+	     ANDROID_FAST_LOCK_SLEEPERS, NULL, NULL, 0) ;
+}
+
+OFC_VOID ofc_fast_lock(OFC_FAST_LOCK *lock)
+{
+  OFC_UINT32 state ;
+
+  state = ANDROID_FAST_LOCK_FREE ;
+  if (!__atomic_compare_exchange_n (&lock->state, &state,
+				    ANDROID_FAST_LOCK_HELD, OFC_FALSE,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    android_fast_lock_contended (lock) ;
+}
+
+OFC_BOOL ofc_fast_lock_try(OFC_FAST_LOCK *lock)
+{
+  OFC_UINT32 state ;
+
+  state = ANDROID_FAST_LOCK_FREE ;
+  return (__atomic_compare_exchange_n (&lock->state, &state,
+				       ANDROID_FAST_LOCK_HELD, OFC_FALSE,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) ;
+}
+
+OFC_VOID ofc_fast_unlock(OFC_FAST_LOCK *lock)
+{
+  if (__atomic_exchange_n (&lock->state, ANDROID_FAST_LOCK_FREE,
+			   __ATOMIC_RELEASE) == ANDROID_FAST_LOCK_SLEEPERS)
+    syscall (SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1,
+	     NULL, NULL, 0) ;
+}
+
+OFC_RWLOCK *ofc_rwlock_init(OFC_VOID)
+{
+  OFC_RWLOCK *lock ;
+
+  android_lock_spin_init () ;
+  lock = ofc_slab_alloc (&android_rwlock_slab) ;
+  if (lock != OFC_NULL)
+    {
+      ofc_memset (lock, '\0', sizeof (OFC_RWLOCK)) ;
+      ofc_fast_lock_init (&lock->write_lock) ;
+    }
+  return (lock) ;
+}
+
+OFC_VOID ofc_rwlock_destroy(OFC_RWLOCK *lock)
+{
+  ofc_slab_free (&android_rwlock_slab, lock) ;
+}
+
+static ANDROID_RWLOCK_SLOT *android_rwlock_slot_get(OFC_RWLOCK *lock)
+{
+  if (android_rwlock_slot < 0)
+    android_rwlock_slot =
+      __atomic_fetch_add (&android_rwlock_next_slot, 1, __ATOMIC_RELAXED) %
+      ANDROID_RWLOCK_SLOTS ;
+  return (&lock->slots[android_rwlock_slot]) ;
+}
+
+static OFC_UINT32 android_rwlock_readers(OFC_RWLOCK *lock)
+{
+  OFC_UINT32 readers ;
+  OFC_INT i ;
+
+  readers = 0 ;
+  for (i = 0 ; i < ANDROID_RWLOCK_SLOTS ; i++)
+    readers += __atomic_load_n (&lock->slots[i].readers, __ATOMIC_SEQ_CST) ;
+  return (readers) ;
+}
+
+/*
+ * Take a reader out of its slot.  A writer waiting for readers to
+ * leave is woken.
+ */
+static OFC_VOID android_rwlock_leave(OFC_RWLOCK *lock,
+				     ANDROID_RWLOCK_SLOT *slot)
+{
+  __atomic_sub_fetch (&slot->readers, 1, __ATOMIC_SEQ_CST) ;
+  if (__atomic_load_n (&lock->writers, __ATOMIC_SEQ_CST) != 0)
+    {
+      __atomic_add_fetch (&lock->drained, 1, __ATOMIC_SEQ_CST) ;
+      if (__atomic_load_n (&lock->writer_asleep, __ATOMIC_SEQ_CST))
+	syscall (SYS_futex, &lock->drained, FUTEX_WAKE_PRIVATE, 1,
+		 NULL, NULL, 0) ;
+    }
+}
+
+OFC_VOID ofc_rwlock_read(OFC_RWLOCK *lock)
+{
+  ANDROID_RWLOCK_SLOT *slot ;
+  OFC_UINT32 gate ;
+
+  slot = android_rwlock_slot_get (lock) ;
+  for (;;)
+    {
+      __atomic_add_fetch (&slot->readers, 1, __ATOMIC_SEQ_CST) ;
+      if (__atomic_load_n (&lock->writers, __ATOMIC_SEQ_CST) == 0)
+	break ;
+      /*
+       * Writers go first.  Leave and wait until there are none.
+       */
+      android_rwlock_leave (lock, slot) ;
+      for (;;)
+	{
+	  gate = __atomic_load_n (&lock->gate, __ATOMIC_SEQ_CST) ;
+	  __atomic_store_n (&lock->readers_asleep, 1, __ATOMIC_SEQ_CST) ;
+	  if (__atomic_load_n (&lock->writers, __ATOMIC_SEQ_CST) == 0)
+	    break ;
+	  syscall (SYS_futex, &lock->gate, FUTEX_WAIT_PRIVATE, gate,
+		   NULL, NULL, 0) ;
+	}
+    }
+}
+
+OFC_VOID ofc_rwlock_read_unlock(OFC_RWLOCK *lock)
+{
+  android_rwlock_leave (lock, android_rwlock_slot_get (lock)) ;
+}
+
+OFC_VOID ofc_rwlock_write(OFC_RWLOCK *lock)
+{
+  OFC_UINT32 drained ;
+  OFC_INT i ;
+
+  /*
+   * Keep new readers out, then wait for the other writers and the
+   * readers already in
+   */
+  __atomic_add_fetch (&lock->writers, 1, __ATOMIC_SEQ_CST) ;
+  ofc_fast_lock (&lock->write_lock) ;
+
+  for (i = 0 ; i < ANDROID_FAST_LOCK_SPIN && android_lock_spin_max > 0 &&
+	 android_rwlock_readers (lock) != 0 ; i++)
+    android_lock_relax () ;
+
+  for (;;)
+    {
+      drained = __atomic_load_n (&lock->drained, __ATOMIC_SEQ_CST) ;
+      __atomic_store_n (&lock->writer_asleep, 1, __ATOMIC_SEQ_CST) ;
+      if (android_rwlock_readers (lock) == 0)
+	break ;
+      syscall (SYS_futex, &lock->drained, FUTEX_WAIT_PRIVATE, drained,
+	       NULL, NULL, 0) ;
+    }
+  __atomic_store_n (&lock->writer_asleep, 0, __ATOMIC_RELAXED) ;
+}
+
+OFC_VOID ofc_rwlock_write_unlock(OFC_RWLOCK *lock)
+{
+  ofc_fast_unlock (&lock->write_lock) ;
+  if (__atomic_sub_fetch (&lock->writers, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+      __atomic_add_fetch (&lock->gate, 1, __ATOMIC_SEQ_CST) ;
+      if (__atomic_exchange_n (&lock->readers_asleep, 0, __ATOMIC_SEQ_CST))
+	syscall (SYS_futex, &lock->gate, FUTEX_WAKE_PRIVATE, INT_MAX,
+		 NULL, NULL, 0) ;
+    }
+}
+
 OFC_VOID ofc_lock_destroy_impl(OFC_LOCK_IMPL *lock)
 {
-  pthread_mutex_destroy (&lock->mutex_lock) ;
-  pthread_mutexattr_destroy (&lock->mutex_attr) ;
-  ofc_free(lock);
+  ofc_fast_lock (&android_lock_list_lock) ;
+  if (lock->prev == OFC_NULL)
+    android_lock_list = lock->next ;
+  else
+    lock->prev->next = lock->next ;
+  if (lock->next != OFC_NULL)
+    lock->next->prev = lock->prev ;
+  ofc_fast_unlock (&android_lock_list_lock) ;
+
+  ofc_slab_free (&android_lock_slab, lock) ;
 }
 
 OFC_VOID *ofc_lock_init_impl(OFC_VOID)
 {
-    OFC_LOCK_IMPL *lock;
+  OFC_LOCK_IMPL *lock ;
+
+  android_lock_spin_init () ;
+  lock = ofc_slab_alloc (&android_lock_slab) ;
+  if (lock != OFC_NULL)
+    {
+      ofc_memset (lock, '\0', sizeof (OFC_LOCK_IMPL)) ;
+      lock->state = ANDROID_LOCK_FREE ;
+      lock->spin = android_lock_spin_max < ANDROID_LOCK_SPIN_MIN ?
+	android_lock_spin_max : ANDROID_LOCK_SPIN_MIN ;
+      lock->caller = OFC_NULL ;
+      lock->stats.lock = lock ;
+#if defined(OFC_STACK_TRACE)
+      lock->stats.creator =
+	ofc_process_relative_addr(__builtin_return_address(1));
+#endif
 
-    lock = ofc_malloc(sizeof(OFC_LOCK_IMPL));
-    pthread_mutexattr_init(&lock->mutex_attr);
-    pthread_mutexattr_settype(&lock->mutex_attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init (&lock->mutex_lock, &lock->mutex_attr) ;
-    lock->caller = OFC_NULL;
-    return (lock);
+      ofc_fast_lock (&android_lock_list_lock) ;
+      lock->prev = OFC_NULL ;
+      lock->next = android_lock_list ;
+      if (android_lock_list != OFC_NULL)
+	android_lock_list->prev = lock ;
+      android_lock_list = lock ;
+      ofc_fast_unlock (&android_lock_list_lock) ;
+    }
+  return (lock) ;
 }
 
 OFC_BOOL ofc_lock_try_impl(OFC_LOCK_IMPL *lock)
 {
   OFC_BOOL ret ;
+  OFC_UINT32 self ;
+  OFC_UINT32 state ;
+  OFC_VOID *site ;
 
   ret = OFC_FALSE ;
-  if (pthread_mutex_trylock (&lock->mutex_lock) == 0)
-    {
+  site = OFC_NULL ;
 #if defined(OFC_STACK_TRACE)
-      lock->caller = ofc_process_relative_addr(__builtin_return_address(1));
+  site = ofc_process_relative_addr(__builtin_return_address(1));
 #endif
+  self = android_lock_self () ;
+  state = ANDROID_LOCK_FREE ;
+  if (__atomic_compare_exchange_n (&lock->state, &state, self, OFC_FALSE,
+				   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      android_lock_owned (lock, site) ;
+      ret = OFC_TRUE ;
+    }
+  else if ((state & ~ANDROID_LOCK_SLEEPERS) == self)
+    {
+      lock->depth++ ;
       ret = OFC_TRUE ;
     }
 
+  if (ret)
+    lock->caller = site ;
   return (ret) ;
 }
 
 OFC_VOID ofc_lock_impl(OFC_LOCK_IMPL *lock)
 {
-    pthread_mutex_lock(&lock->mutex_lock);
+  OFC_UINT32 self ;
+  OFC_UINT32 state ;
+  OFC_VOID *site ;
+
+  site = OFC_NULL ;
 #if defined(OFC_STACK_TRACE)
-    lock->caller = ofc_process_relative_addr(__builtin_return_address(1));
+  site = ofc_process_relative_addr(__builtin_return_address(1));
 #endif
+  self = android_lock_self () ;
+  state = ANDROID_LOCK_FREE ;
+  if (__atomic_compare_exchange_n (&lock->state, &state, self, OFC_FALSE,
+				   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    android_lock_owned (lock, site) ;
+  else if ((state & ~ANDROID_LOCK_SLEEPERS) == self)
+    lock->depth++ ;
+  else
+    android_lock_contended (lock, self, site) ;
+  lock->caller = site ;
 }
 
 OFC_VOID ofc_unlock_impl(OFC_LOCK_IMPL *lock)
 {
+  OFC_UINT64 hold ;
+
+#if defined(OFC_STACK_TRACE)
+  lock->caller = ofc_process_relative_addr(__builtin_return_address(1));
+#endif
+  if (--lock->depth > 0)
+    return ;
+
+  if (lock->held_at != 0)
+    {
+      hold = android_lock_clock () - lock->held_at ;
+      android_lock_add (&lock->stats.hold_nsec, hold) ;
+      android_lock_hist (lock->stats.hold_hist, hold) ;
+      android_lock_site_held (lock->site, hold) ;
+    }
+
+  if (__atomic_exchange_n (&lock->state, ANDROID_LOCK_FREE,
+			   __ATOMIC_RELEASE) & ANDROID_LOCK_SLEEPERS)
+    syscall (SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1,
+	     NULL, NULL, 0) ;
+}
+
+OFC_VOID ofc_lock_profile(OFC_BOOL enable)
+{
+  __atomic_store_n (&android_lock_profiling, enable, __ATOMIC_RELAXED) ;
+}
+
+/*
+ * Copy a set of statistics field by field since the owner may be
+ * updating them
+ */
+static OFC_VOID android_lock_copy(OFC_LOCK_STATS *dst,
+				  const OFC_LOCK_STATS *src)
+{
+  OFC_INT i ;
+
+  dst->lock = src->lock ;
+  dst->creator = src->creator ;
+  dst->acquired = __atomic_load_n (&src->acquired, __ATOMIC_RELAXED) ;
+  dst->contended = __atomic_load_n (&src->contended, __ATOMIC_RELAXED) ;
+  dst->parked = __atomic_load_n (&src->parked, __ATOMIC_RELAXED) ;
+  dst->wait_nsec = __atomic_load_n (&src->wait_nsec, __ATOMIC_RELAXED) ;
+  dst->hold_nsec = __atomic_load_n (&src->hold_nsec, __ATOMIC_RELAXED) ;
+  for (i = 0 ; i < OFC_LOCK_STATS_BUCKETS ; i++)
+    {
+      dst->wait_hist[i] =
+	__atomic_load_n (&src->wait_hist[i], __ATOMIC_RELAXED) ;
+      dst->hold_hist[i] =
+	__atomic_load_n (&src->hold_hist[i], __ATOMIC_RELAXED) ;
+    }
+}
+
+OFC_INT ofc_lock_get_stats(OFC_LOCK_STATS *stats, OFC_INT count)
+{
+  OFC_LOCK_IMPL *lock ;
+  OFC_UINT64 contended ;
+  OFC_INT num ;
+  OFC_INT i ;
+
+  /*
+   * Insertion sort into the caller's array.  Locks that were never
+   * contended aren't reported.
+   */
+  num = 0 ;
+  ofc_fast_lock (&android_lock_list_lock) ;
+  for (lock = android_lock_list ; lock != OFC_NULL ; lock = lock->next)
+    {
+      contended = __atomic_load_n (&lock->stats.contended, __ATOMIC_RELAXED) ;
+      if (contended == 0)
+	continue ;
+      for (i = num ; i > 0 && stats[i-1].contended < contended ; i--)
+	{
+	  if (i < count)
+	    stats[i] = stats[i-1] ;
+	}
+      if (i < count)
+	{
+	  android_lock_copy (&stats[i], &lock->stats) ;
+	  if (num < count)
+	    num++ ;
+	}
+    }
+  ofc_fast_unlock (&android_lock_list_lock) ;
+  return (num) ;
+}
+
+OFC_INT ofc_lock_get_site_stats(OFC_LOCK_SITE_STATS *stats, OFC_INT count)
+{
+  OFC_INT num ;
+#if defined(OFC_STACK_TRACE)
+  OFC_LOCK_SITE_STATS *site ;
+  OFC_UINT64 contended ;
+  OFC_INT i ;
+  OFC_INT j ;
+  OFC_INT k ;
+
+  num = 0 ;
+  for (j = 0 ; j < ANDROID_LOCK_SITES ; j++)
+    {
+      site = &android_lock_sites[j] ;
+      if (__atomic_load_n (&site->caller, __ATOMIC_ACQUIRE) == OFC_NULL)
+	continue ;
+      contended = __atomic_load_n (&site->contended, __ATOMIC_RELAXED) ;
+      for (i = num ; i > 0 && stats[i-1].contended < contended ; i--)
+	{
+	  if (i < count)
+	    stats[i] = stats[i-1] ;
+	}
+      if (i < count)
+	{
+	  stats[i].caller = site->caller ;
+	  stats[i].acquired =
+	    __atomic_load_n (&site->acquired, __ATOMIC_RELAXED) ;
+	  stats[i].contended = contended ;
+	  stats[i].wait_nsec =
+	    __atomic_load_n (&site->wait_nsec, __ATOMIC_RELAXED) ;
+	  stats[i].hold_nsec =
+	    __atomic_load_n (&site->hold_nsec, __ATOMIC_RELAXED) ;
+	  for (k = 0 ; k < OFC_LOCK_STATS_BUCKETS ; k++)
+	    {
+	      stats[i].wait_hist[k] =
+		__atomic_load_n (&site->wait_hist[k], __ATOMIC_RELAXED) ;
+	      stats[i].hold_hist[k] =
+		__atomic_load_n (&site->hold_hist[k], __ATOMIC_RELAXED) ;
+	    }
+	  if (num < count)
+	    num++ ;
+	}
+    }
+#else
+  num = 0 ;
+#endif
+  return (num) ;
+}
+
+OFC_VOID ofc_lock_reset_stats(OFC_VOID)
+{
+  OFC_LOCK_IMPL *lock ;
+  OFC_INT i ;
 #if defined(OFC_STACK_TRACE)
-    lock->caller = ofc_process_relative_addr(__builtin_return_address(1));
+  OFC_LOCK_SITE_STATS *site ;
+  OFC_INT j ;
+#endif
+
+  ofc_fast_lock (&android_lock_list_lock) ;
+  for (lock = android_lock_list ; lock != OFC_NULL ; lock = lock->next)
+    {
+      __atomic_store_n (&lock->stats.acquired, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&lock->stats.contended, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&lock->stats.parked, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&lock->stats.wait_nsec, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&lock->stats.hold_nsec, 0, __ATOMIC_RELAXED) ;
+      for (i = 0 ; i < OFC_LOCK_STATS_BUCKETS ; i++)
+	{
+	  __atomic_store_n (&lock->stats.wait_hist[i], 0, __ATOMIC_RELAXED) ;
+	  __atomic_store_n (&lock->stats.hold_hist[i], 0, __ATOMIC_RELAXED) ;
+	}
+    }
+  ofc_fast_unlock (&android_lock_list_lock) ;
+
+#if defined(OFC_STACK_TRACE)
+  /*
+   * Sites keep their slots
+   */
+  for (i = 0 ; i < ANDROID_LOCK_SITES ; i++)
+    {
+      site = &android_lock_sites[i] ;
+      __atomic_store_n (&site->acquired, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&site->contended, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&site->wait_nsec, 0, __ATOMIC_RELAXED) ;
+      __atomic_store_n (&site->hold_nsec, 0, __ATOMIC_RELAXED) ;
+      for (j = 0 ; j < OFC_LOCK_STATS_BUCKETS ; j++)
+	{
+	  __atomic_store_n (&site->wait_hist[j], 0, __ATOMIC_RELAXED) ;
+	  __atomic_store_n (&site->hold_hist[j], 0, __ATOMIC_RELAXED) ;
+	}
+    }
 #endif
-    pthread_mutex_unlock(&lock->mutex_lock);
 }
 
+static OFC_VOID android_lock_log(OFC_CCHAR *obuf)
+{
+  ofc_write_log_impl(OFC_LOG_INFO, obuf, ofc_strlen(obuf)) ;
+}
+
+static OFC_VOID android_lock_log_hist(OFC_CCHAR *name, OFC_UINT32 *hist)
+{
+  OFC_CHAR obuf[OFC_LOCK_STATS_BUCKETS * 11 + 32] ;
+  OFC_SIZET len ;
+  OFC_INT bucket ;
+
+  len = ofc_snprintf (obuf, sizeof (obuf), "    %s:", name) ;
+  for (bucket = 0 ; bucket < OFC_LOCK_STATS_BUCKETS ; bucket++)
+    len += ofc_snprintf (obuf + len, sizeof (obuf) - len, " %u",
+			 hist[bucket]) ;
+  ofc_snprintf (obuf + len, sizeof (obuf) - len, "\n") ;
+  android_lock_log(obuf) ;
+}
+
+OFC_VOID ofc_lock_log_stats(OFC_INT count)
+{
+  OFC_LOCK_STATS *stats ;
+  OFC_LOCK_SITE_STATS *sites ;
+  OFC_CHAR obuf[200] ;
+  OFC_INT num ;
+  OFC_INT i ;
+
+  android_lock_log("Lock Statistics\n") ;
+  stats = ofc_malloc (sizeof (OFC_LOCK_STATS) * count) ;
+  if (stats != OFC_NULL)
+    {
+      num = ofc_lock_get_stats (stats, count) ;
+      for (i = 0 ; i < num ; i++)
+	{
+	  ofc_snprintf (obuf, sizeof (obuf),
+			"  lock %p created at %p: acquired %llu, "
+			"contended %llu, parked %llu, waited %llu ns, "
+			"held %llu ns\n",
+			stats[i].lock, stats[i].creator,
+			(unsigned long long) stats[i].acquired,
+			(unsigned long long) stats[i].contended,
+			(unsigned long long) stats[i].parked,
+			(unsigned long long) stats[i].wait_nsec,
+			(unsigned long long) stats[i].hold_nsec) ;
+	  android_lock_log(obuf) ;
+	  android_lock_log_hist("wait", stats[i].wait_hist) ;
+	  android_lock_log_hist("hold", stats[i].hold_hist) ;
+	}
+      ofc_free (stats) ;
+    }
+
+  sites = ofc_malloc (sizeof (OFC_LOCK_SITE_STATS) * count) ;
+  if (sites != OFC_NULL)
+    {
+      num = ofc_lock_get_site_stats (sites, count) ;
+      for (i = 0 ; i < num ; i++)
+	{
+	  ofc_snprintf (obuf, sizeof (obuf),
+			"  site %p: acquired %llu, contended %llu, "
+			"waited %llu ns, held %llu ns\n",
+			sites[i].caller,
+			(unsigned long long) sites[i].acquired,
+			(unsigned long long) sites[i].contended,
+			(unsigned long long) sites[i].wait_nsec,
+			(unsigned long long) sites[i].hold_nsec) ;
+	  android_lock_log(obuf) ;
+	  android_lock_log_hist("wait", sites[i].wait_hist) ;
+	  android_lock_log_hist("hold", sites[i].hold_hist) ;
+	}
+      ofc_free (sites) ;
+    }
+}
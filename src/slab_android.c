@@ -0,0 +1,305 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "ofc/types.h"
+#include "ofc/libc.h"
+#include "ofc/impl/consoleimpl.h"
+
+#include "ofc_android/lock_android.h"
+#include "ofc_android/slab_android.h"
+
+/*
+ * Objects are carved out of chunks mapped straight from the system
+ * rather than from the heap.  The heap and the locks behind it are
+ * themselves clients of these pools.  For the same reason the pools
+ * are guarded by fast locks, which need no allocation.
+ */
+#define ANDROID_SLAB_ALIGN 16
+#define ANDROID_SLAB_CHUNK 65536
+/*
+ * Objects moved between a thread's cache and the pool at once, and
+ * the most a thread's cache holds before it gives some back
+ */
+#define ANDROID_SLAB_BATCH 32
+#define ANDROID_SLAB_CACHE_MAX 64
+
+typedef struct
+{
+  OFC_VOID *head ;
+  OFC_UINT32 count ;
+} ANDROID_SLAB_CACHE ;
+
+static OFC_FAST_LOCK android_slab_lock = OFC_FAST_LOCK_INIT ;
+static OFC_SLAB *android_slab_list ;
+static OFC_INT android_slab_count ;
+
+static pthread_once_t android_slab_once = PTHREAD_ONCE_INIT ;
+static pthread_key_t android_slab_key ;
+
+static __thread ANDROID_SLAB_CACHE android_slab_cache[OFC_SLAB_MAX] ;
+static __thread OFC_BOOL android_slab_cached ;
+
+static OFC_VOID android_slab_register(OFC_SLAB *slab)
+{
+  ofc_fast_lock (&android_slab_lock) ;
+  if (__atomic_load_n (&slab->index, __ATOMIC_RELAXED) < 0)
+    {
+      slab->size = (slab->size + ANDROID_SLAB_ALIGN - 1) &
+	~((OFC_SIZET) ANDROID_SLAB_ALIGN - 1) ;
+      if (slab->size == 0)
+	slab->size = ANDROID_SLAB_ALIGN ;
+      /*
+       * Pools past the cache array share the last index, which is
+       * never used to find a cache.  The index is set before the pool
+       * is published since exiting threads walk the list unlocked.
+       */
+      __atomic_store_n (&slab->index,
+			android_slab_count < OFC_SLAB_MAX ?
+			android_slab_count : OFC_SLAB_MAX,
+			__ATOMIC_RELEASE) ;
+      android_slab_count++ ;
+      slab->next = android_slab_list ;
+      __atomic_store_n (&android_slab_list, slab, __ATOMIC_RELEASE) ;
+    }
+  ofc_fast_unlock (&android_slab_lock) ;
+}
+
+/*
+ * Called with the pool locked.  Map a chunk and put its objects on
+ * the pool's free list.
+ */
+static OFC_BOOL android_slab_grow(OFC_SLAB *slab)
+{
+  OFC_SIZET len ;
+  OFC_CHAR *chunk ;
+  OFC_SIZET i ;
+  OFC_VOID **obj ;
+
+  len = ANDROID_SLAB_CHUNK ;
+  if (slab->size * ANDROID_SLAB_BATCH > len)
+    len = (slab->size * ANDROID_SLAB_BATCH + ANDROID_SLAB_CHUNK - 1) &
+      ~((OFC_SIZET) ANDROID_SLAB_CHUNK - 1) ;
+
+  chunk = mmap (OFC_NULL, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) ;
+  if (chunk == MAP_FAILED)
+    return (OFC_FALSE) ;
+
+  for (i = len / slab->size ; i > 0 ; i--)
+    {
+      obj = (OFC_VOID **) (chunk + (i - 1) * slab->size) ;
+      *obj = slab->free ;
+      slab->free = obj ;
+    }
+  slab->chunks++ ;
+  return (OFC_TRUE) ;
+}
+
+/*
+ * Called with the pool locked
+ */
+static OFC_VOID *android_slab_pop(OFC_SLAB *slab)
+{
+  OFC_VOID *obj ;
+
+  if (slab->free == OFC_NULL && !android_slab_grow (slab))
+    return (OFC_NULL) ;
+  obj = slab->free ;
+  slab->free = *(OFC_VOID **) obj ;
+  return (obj) ;
+}
+
+static OFC_VOID android_slab_flush(OFC_SLAB *slab,
+				   ANDROID_SLAB_CACHE *cache,
+				   OFC_UINT32 count)
+{
+  OFC_VOID *obj ;
+
+  ofc_fast_lock (&slab->lock) ;
+  for ( ; count > 0 && cache->head != OFC_NULL ; count--)
+    {
+      obj = cache->head ;
+      cache->head = *(OFC_VOID **) obj ;
+      cache->count-- ;
+      *(OFC_VOID **) obj = slab->free ;
+      slab->free = obj ;
+    }
+  ofc_fast_unlock (&slab->lock) ;
+}
+
+static OFC_VOID android_slab_exit(OFC_VOID *arg)
+{
+  OFC_SLAB *slab ;
+  OFC_INT index ;
+
+  /*
+   * Give the thread's caches back to their pools.  Pools are never
+   * removed from the list, so it can be walked without the lock once
+   * the head has been read.
+   */
+  android_slab_cached = OFC_FALSE ;
+  for (slab = __atomic_load_n (&android_slab_list, __ATOMIC_ACQUIRE) ;
+       slab != OFC_NULL ; slab = slab->next)
+    {
+      index = __atomic_load_n (&slab->index, __ATOMIC_ACQUIRE) ;
+      if (index >= 0 && index < OFC_SLAB_MAX)
+	android_slab_flush (slab, &android_slab_cache[index],
+			    android_slab_cache[index].count) ;
+    }
+}
+
+static OFC_VOID android_slab_key_create(OFC_VOID)
+{
+  pthread_key_create (&android_slab_key, android_slab_exit) ;
+}
+
+/*
+ * Returns the thread's cache for a pool, or OFC_NULL if the pool
+ * has none
+ */
+static ANDROID_SLAB_CACHE *android_slab_thread_cache(OFC_SLAB *slab)
+{
+  OFC_INT index ;
+
+  index = __atomic_load_n (&slab->index, __ATOMIC_ACQUIRE) ;
+  if (index < 0)
+    {
+      android_slab_register (slab) ;
+      index = slab->index ;
+    }
+  if (index >= OFC_SLAB_MAX)
+    return (OFC_NULL) ;
+
+  if (!android_slab_cached)
+    {
+      /*
+       * The key's value only has to be non null for the destructor
+       * to run when the thread exits
+       */
+      pthread_once (&android_slab_once, android_slab_key_create) ;
+      pthread_setspecific (android_slab_key, &android_slab_cached) ;
+      android_slab_cached = OFC_TRUE ;
+    }
+  return (&android_slab_cache[index]) ;
+}
+
+static OFC_VOID android_slab_count_alloc(OFC_SLAB *slab)
+{
+  OFC_UINT32 live ;
+  OFC_UINT32 peak ;
+
+  live = __atomic_add_fetch (&slab->live, 1, __ATOMIC_RELAXED) ;
+  peak = __atomic_load_n (&slab->peak, __ATOMIC_RELAXED) ;
+  while (live > peak &&
+	 !__atomic_compare_exchange_n (&slab->peak, &peak, live, OFC_TRUE,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+}
+
+OFC_VOID *ofc_slab_alloc(OFC_SLAB *slab)
+{
+  ANDROID_SLAB_CACHE *cache ;
+  OFC_VOID *obj ;
+
+  cache = android_slab_thread_cache (slab) ;
+  if (cache == OFC_NULL)
+    {
+      ofc_fast_lock (&slab->lock) ;
+      obj = android_slab_pop (slab) ;
+      ofc_fast_unlock (&slab->lock) ;
+    }
+  else
+    {
+      if (cache->head == OFC_NULL)
+	{
+	  ofc_fast_lock (&slab->lock) ;
+	  while (cache->count < ANDROID_SLAB_BATCH &&
+		 (obj = android_slab_pop (slab)) != OFC_NULL)
+	    {
+	      *(OFC_VOID **) obj = cache->head ;
+	      cache->head = obj ;
+	      cache->count++ ;
+	    }
+	  ofc_fast_unlock (&slab->lock) ;
+	}
+      obj = cache->head ;
+      if (obj != OFC_NULL)
+	{
+	  cache->head = *(OFC_VOID **) obj ;
+	  cache->count-- ;
+	}
+    }
+
+  if (obj != OFC_NULL)
+    android_slab_count_alloc (slab) ;
+  return (obj) ;
+}
+
+OFC_VOID ofc_slab_free(OFC_SLAB *slab, OFC_VOID *obj)
+{
+  ANDROID_SLAB_CACHE *cache ;
+
+  if (obj == OFC_NULL)
+    return ;
+
+  __atomic_sub_fetch (&slab->live, 1, __ATOMIC_RELAXED) ;
+
+  cache = android_slab_thread_cache (slab) ;
+  if (cache == OFC_NULL)
+    {
+      ofc_fast_lock (&slab->lock) ;
+      *(OFC_VOID **) obj = slab->free ;
+      slab->free = obj ;
+      ofc_fast_unlock (&slab->lock) ;
+    }
+  else
+    {
+      *(OFC_VOID **) obj = cache->head ;
+      cache->head = obj ;
+      cache->count++ ;
+      if (cache->count > ANDROID_SLAB_CACHE_MAX)
+	android_slab_flush (slab, cache, ANDROID_SLAB_BATCH) ;
+    }
+}
+
+OFC_INT ofc_slab_get_stats(OFC_SLAB_STATS *stats, OFC_INT count)
+{
+  OFC_SLAB *slab ;
+  OFC_INT i ;
+
+  i = 0 ;
+  for (slab = __atomic_load_n (&android_slab_list, __ATOMIC_ACQUIRE) ;
+       slab != OFC_NULL && i < count ; slab = slab->next, i++)
+    {
+      stats[i].name = slab->name ;
+      stats[i].size = slab->size ;
+      stats[i].live = __atomic_load_n (&slab->live, __ATOMIC_RELAXED) ;
+      stats[i].peak = __atomic_load_n (&slab->peak, __ATOMIC_RELAXED) ;
+      stats[i].chunks = __atomic_load_n (&slab->chunks, __ATOMIC_RELAXED) ;
+    }
+  return (i) ;
+}
+
+OFC_VOID ofc_slab_log_stats(OFC_VOID)
+{
+  OFC_SLAB *slab ;
+  OFC_CHAR obuf[160] ;
+
+  ofc_snprintf (obuf, sizeof (obuf), "Object Pool Statistics\n") ;
+  ofc_write_log_impl (OFC_LOG_INFO, obuf, ofc_strlen (obuf)) ;
+  for (slab = __atomic_load_n (&android_slab_list, __ATOMIC_ACQUIRE) ;
+       slab != OFC_NULL ; slab = slab->next)
+    {
+      ofc_snprintf (obuf, sizeof (obuf),
+		    "  %s: size %u, live %u, peak %u, chunks %u\n",
+		    slab->name, (unsigned int) slab->size,
+		    __atomic_load_n (&slab->live, __ATOMIC_RELAXED),
+		    __atomic_load_n (&slab->peak, __ATOMIC_RELAXED),
+		    __atomic_load_n (&slab->chunks, __ATOMIC_RELAXED)) ;
+      ofc_write_log_impl (OFC_LOG_INFO, obuf, ofc_strlen (obuf)) ;
+    }
+}
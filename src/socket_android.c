@@ -22,6 +22,9 @@
 #include "ofc/net_internal.h"
 
 #include "ofc/heap.h"
+
+#include "ofc_android/socket_android.h"
+#include "ofc_android/slab_android.h"
 /*
  * PSP_Socket - Create a Network Socket.
  *
@@ -46,8 +49,40 @@ typedef struct
   OFC_UINT16 revents ;
   OFC_IPADDR ip ;
   OFC_BOOL remote_closed ;
+  /*
+   * Copy of the installed watch.  The lock is never held while a
+   * callback runs, since the callbacks take the watcher's locks and
+   * the watcher installs and removes watches holding them.
+   */
+  OFC_FAST_LOCK watch_lock ;
+  OFC_BOOL watched ;
+  OFC_SOCKET_WATCH watch ;
 } OFC_SOCKET_IMPL ;
 
+static OFC_SLAB android_socket_slab =
+  OFC_SLAB_INIT ("socket", sizeof (OFC_SOCKET_IMPL)) ;
+static OFC_UINT32 android_socket_watch_serial ;
+
+/*
+ * Take the installed watch off a socket.  Returns whether there was
+ * one, in which case it is copied to watch.
+ */
+static OFC_BOOL android_socket_unwatch(OFC_SOCKET_IMPL *sock,
+				       OFC_SOCKET_WATCH *watch)
+{
+  OFC_BOOL ret ;
+
+  ofc_fast_lock (&sock->watch_lock) ;
+  ret = sock->watched ;
+  if (ret)
+    {
+      *watch = sock->watch ;
+      sock->watched = OFC_FALSE ;
+    }
+  ofc_fast_unlock (&sock->watch_lock) ;
+  return (ret) ;
+}
+
 OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
                                   OFC_SOCKET_TYPE socktype)
 {
@@ -60,13 +95,15 @@ OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
   int on ;
   
   hSocket = OFC_HANDLE_NULL ;
-  sock = ofc_malloc(sizeof (OFC_SOCKET_IMPL)) ;
+  sock = ofc_slab_alloc (&android_socket_slab) ;
   if (sock != OFC_NULL)
     {
       sock->family = family ;
       sock->revents = 0 ;
       sock->events = 0 ;
       sock->remote_closed = OFC_FALSE ;
+      ofc_fast_lock_init (&sock->watch_lock) ;
+      sock->watched = OFC_FALSE ;
 
       if (sock->family == OFC_FAMILY_IP)
 	{
@@ -104,7 +141,7 @@ OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
 
       if (sock->socket < 0)
 	{
-	  ofc_free (sock) ;
+	  ofc_slab_free (&android_socket_slab, sock) ;
 	}
       else
 	{
@@ -123,11 +160,14 @@ OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
 OFC_VOID ofc_socket_impl_destroy(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_WATCH watch ;
 
   sock = ofc_handle_lock(hSocket) ;
   if (sock != OFC_NULL)
     {
-      ofc_free(sock) ;
+      if (android_socket_unwatch (sock, &watch))
+	watch.close(&watch) ;
+      ofc_slab_free (&android_socket_slab, sock) ;
       ofc_handle_destroy(hSocket) ;
       ofc_handle_unlock(hSocket) ;
     }
@@ -253,12 +293,15 @@ OFC_BOOL ofc_socket_impl_bind(OFC_HANDLE hSocket, const OFC_IPADDR *ip,
 OFC_BOOL ofc_socket_impl_close(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_WATCH watch ;
   OFC_BOOL ret ;
 
   ret = OFC_FALSE ;
   sock = ofc_handle_lock(hSocket) ;
   if (sock != OFC_NULL)
     {
+      if (android_socket_unwatch (sock, &watch))
+	watch.close(&watch) ;
       close (sock->socket);
       ofc_handle_unlock (hSocket) ;
       ret = OFC_TRUE ;
@@ -359,10 +402,12 @@ OFC_HANDLE ofc_socket_impl_accept(OFC_HANDLE hSocket,
   sock = ofc_handle_lock(hSocket) ;
   if (sock != OFC_NULL)
     {
-      newsock = ofc_malloc(sizeof (OFC_SOCKET_IMPL)) ;
+      newsock = ofc_slab_alloc (&android_socket_slab) ;
       addrlen = sizeof(struct sockaddr);
 
       newsock->remote_closed = OFC_FALSE ;
+      ofc_fast_lock_init (&newsock->watch_lock) ;
+      newsock->watched = OFC_FALSE ;
       newsock->socket = accept(sock->socket, &mysockaddr, &addrlen);
       if (newsock->socket != -1)
 	{
@@ -370,7 +415,7 @@ OFC_HANDLE ofc_socket_impl_accept(OFC_HANDLE hSocket,
 	  hNewSock = ofc_handle_create(OFC_HANDLE_SOCKET_IMPL, newsock);
 	}
       else
-	ofc_free(newsock) ;
+	ofc_slab_free (&android_socket_slab, newsock) ;
 
       ofc_handle_unlock(hSocket) ;
     }
@@ -648,7 +693,7 @@ OFC_VOID ofc_socket_impl_set_event(OFC_HANDLE hSocket,
   pSocket = ofc_handle_lock(hSocket) ;
   if (pSocket != OFC_NULL)
     {
-      pSocket->revents = revents ;
+      __atomic_store_n (&pSocket->revents, revents, __ATOMIC_RELAXED) ;
       ofc_handle_unlock(hSocket) ;
     }
 }
@@ -684,27 +729,78 @@ int ofc_socket_impl_get_fd(OFC_HANDLE hSocket)
   return (fd) ;
 }
 
+int ofc_socket_impl_watch(OFC_HANDLE hSocket, OFC_SOCKET_WATCH *watch,
+                          OFC_UINT16 *events, OFC_SOCKET_WATCH *old)
+{
+  OFC_SOCKET_IMPL *pSocket ;
+  int fd ;
+
+  fd = -1 ;
+  *events = 0 ;
+  old->close = OFC_NULL ;
+
+  pSocket = ofc_handle_lock(hSocket) ;
+  if (pSocket != OFC_NULL)
+    {
+      ofc_fast_lock (&pSocket->watch_lock) ;
+      if (pSocket->watched)
+	*old = pSocket->watch ;
+      watch->serial = __atomic_add_fetch (&android_socket_watch_serial, 1,
+					  __ATOMIC_RELAXED) ;
+      watch->revents = &pSocket->revents ;
+      watch->events = &pSocket->events ;
+      pSocket->watch = *watch ;
+      pSocket->watched = OFC_TRUE ;
+      fd = pSocket->socket ;
+      *events = pSocket->events ;
+      ofc_fast_unlock (&pSocket->watch_lock) ;
+      ofc_handle_unlock(hSocket) ;
+    }
+  return (fd) ;
+}
+
+OFC_VOID ofc_socket_impl_unwatch(OFC_HANDLE hSocket,
+                                 OFC_SOCKET_WATCH *watch)
+{
+  OFC_SOCKET_IMPL *pSocket ;
+
+  pSocket = ofc_handle_lock(hSocket) ;
+  if (pSocket != OFC_NULL)
+    {
+      ofc_fast_lock (&pSocket->watch_lock) ;
+      if (pSocket->watched && pSocket->watch.serial == watch->serial)
+	pSocket->watched = OFC_FALSE ;
+      ofc_fast_unlock (&pSocket->watch_lock) ;
+      ofc_handle_unlock(hSocket) ;
+    }
+}
+
 OFC_SOCKET_EVENT_TYPE ofc_socket_impl_test(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *pSocket ;
   OFC_SOCKET_EVENT_TYPE EventTest ;
+  OFC_UINT16 revents ;
 
   EventTest = 0 ;
 
   pSocket = ofc_handle_lock(hSocket) ;
   if (pSocket != OFC_NULL)
     {
+      /*
+       * A wait set may store to this without the handle lock
+       */
+      revents = __atomic_load_n (&pSocket->revents, __ATOMIC_RELAXED) ;
       if (pSocket->remote_closed)
 	EventTest |= OFC_SOCKET_EVENT_CLOSE ;
-      if (pSocket->revents & POLLHUP)
+      if (revents & POLLHUP)
 	EventTest |= OFC_SOCKET_EVENT_CLOSE ;
-      if (pSocket->revents & POLLIN)
+      if (revents & POLLIN)
 	EventTest |= (OFC_SOCKET_EVENT_ACCEPT | OFC_SOCKET_EVENT_READ);
-      if (pSocket->revents & POLLERR)
+      if (revents & POLLERR)
 	EventTest |= OFC_SOCKET_EVENT_ADDRESSCHANGE ;
-      if (pSocket->revents & POLLPRI)
+      if (revents & POLLPRI)
 	EventTest |= OFC_SOCKET_EVENT_QOS ;
-      if (pSocket->revents & POLLOUT)
+      if (revents & POLLOUT)
 	EventTest |= OFC_SOCKET_EVENT_WRITE ;
 
       ofc_handle_unlock(hSocket) ;
@@ -717,7 +813,9 @@ OFC_BOOL ofc_socket_impl_enable(OFC_HANDLE hSocket,
                                 OFC_SOCKET_EVENT_TYPE type)
 {
   OFC_SOCKET_IMPL *pSocket ;
+  OFC_SOCKET_WATCH watch ;
   OFC_INT EventTest ;
+  OFC_BOOL watched ;
   OFC_BOOL ret ;
 
   ret = OFC_FALSE ;
@@ -739,7 +837,17 @@ OFC_BOOL ofc_socket_impl_enable(OFC_HANDLE hSocket,
       if (type & OFC_SOCKET_EVENT_WRITE)
 	EventTest |= POLLOUT ;
 
-      pSocket->events = EventTest ;
+      /*
+       * A watch reads the mask without the lock
+       */
+      ofc_fast_lock (&pSocket->watch_lock) ;
+      __atomic_store_n (&pSocket->events, EventTest, __ATOMIC_RELAXED) ;
+      watched = pSocket->watched ;
+      if (watched)
+	watch = pSocket->watch ;
+      ofc_fast_unlock (&pSocket->watch_lock) ;
+      if (watched)
+	watch.update(&watch) ;
       ofc_handle_unlock(hSocket) ;
       ret = OFC_TRUE ;
     }
@@ -0,0 +1,461 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/event.h"
+#include "ofc/thread.h"
+#include "ofc/impl/threadimpl.h"
+#include "ofc/heap.h"
+#include "ofc/libc.h"
+
+#include "ofc_android/lock_android.h"
+#include "ofc_android/slab_android.h"
+#include "ofc_android/taskpool_android.h"
+
+/*
+ * Initial number of tasks a worker's deque holds.  A power of two.
+ * Deques double when full.
+ */
+#define ANDROID_TASK_DEQUE_SIZE 256
+#define ANDROID_CACHE_LINE 64
+
+typedef struct android_task
+{
+  OFC_TASK_FN *fn ;
+  OFC_VOID *context ;
+  OFC_TASK_GROUP *group ;
+  struct android_task *next ;
+} ANDROID_TASK ;
+
+struct ofc_task_group
+{
+  /*
+   * Tasks not yet run, plus one until the group is closed
+   */
+  OFC_UINT32 pending ;
+  OFC_HANDLE hEvent ;
+} ;
+
+typedef struct android_task_array
+{
+  OFC_INT64 size ;
+  struct android_task_array *prev ;
+  ANDROID_TASK *tasks[] ;
+} ANDROID_TASK_ARRAY ;
+
+/*
+ * Chase-Lev deque.  The owner pushes and takes at the bottom, others
+ * steal from the top.  Arrays that have been outgrown are kept until
+ * the pool is destroyed since a thief may still be reading them.
+ */
+typedef struct
+{
+  OFC_INT64 top __attribute__((aligned (ANDROID_CACHE_LINE))) ;
+  OFC_INT64 bottom __attribute__((aligned (ANDROID_CACHE_LINE))) ;
+  ANDROID_TASK_ARRAY *array ;
+} ANDROID_TASK_DEQUE ;
+
+typedef struct
+{
+  ANDROID_TASK_DEQUE deque ;
+  OFC_TASK_POOL *pool ;
+  OFC_HANDLE hThread ;
+  OFC_UINT32 seed ;
+} ANDROID_TASK_WORKER ;
+
+struct ofc_task_pool
+{
+  OFC_INT count ;
+  OFC_INT started ;
+  ANDROID_TASK_WORKER *workers ;
+  /*
+   * Tasks submitted from outside the pool
+   */
+  OFC_FAST_LOCK lock ;
+  ANDROID_TASK *head ;
+  ANDROID_TASK *tail ;
+  /*
+   * Idle workers sleep on work, which moves whenever a task is
+   * submitted, if sleepers says some may be asleep
+   */
+  OFC_UINT32 work __attribute__((aligned (ANDROID_CACHE_LINE))) ;
+  OFC_UINT32 sleepers ;
+  OFC_BOOL stop ;
+} ;
+
+static OFC_SLAB android_task_slab =
+  OFC_SLAB_INIT ("task", sizeof (ANDROID_TASK)) ;
+
+static __thread ANDROID_TASK_WORKER *android_task_self ;
+
+static ANDROID_TASK_ARRAY *android_task_array_alloc(OFC_INT64 size)
+{
+  ANDROID_TASK_ARRAY *array ;
+
+  array = ofc_malloc (sizeof (ANDROID_TASK_ARRAY) +
+		      sizeof (ANDROID_TASK *) * size) ;
+  if (array != OFC_NULL)
+    {
+      array->size = size ;
+      array->prev = OFC_NULL ;
+    }
+  return (array) ;
+}
+
+static OFC_BOOL android_task_push(ANDROID_TASK_DEQUE *deque,
+				  ANDROID_TASK *task)
+{
+  OFC_INT64 bottom ;
+  OFC_INT64 top ;
+  OFC_INT64 i ;
+  ANDROID_TASK_ARRAY *array ;
+  ANDROID_TASK_ARRAY *grown ;
+
+  bottom = __atomic_load_n (&deque->bottom, __ATOMIC_RELAXED) ;
+  top = __atomic_load_n (&deque->top, __ATOMIC_ACQUIRE) ;
+  array = __atomic_load_n (&deque->array, __ATOMIC_RELAXED) ;
+  if (bottom - top > array->size - 1)
+    {
+      grown = android_task_array_alloc (array->size * 2) ;
+      if (grown == OFC_NULL)
+	return (OFC_FALSE) ;
+      for (i = top ; i < bottom ; i++)
+	grown->tasks[i & (grown->size - 1)] =
+	  __atomic_load_n (&array->tasks[i & (array->size - 1)],
+			   __ATOMIC_RELAXED) ;
+      grown->prev = array ;
+      __atomic_store_n (&deque->array, grown, __ATOMIC_RELEASE) ;
+      array = grown ;
+    }
+  __atomic_store_n (&array->tasks[bottom & (array->size - 1)], task,
+		    __ATOMIC_RELAXED) ;
+  __atomic_store_n (&deque->bottom, bottom + 1, __ATOMIC_RELEASE) ;
+  return (OFC_TRUE) ;
+}
+
+static ANDROID_TASK *android_task_take(ANDROID_TASK_DEQUE *deque)
+{
+  OFC_INT64 bottom ;
+  OFC_INT64 top ;
+  ANDROID_TASK_ARRAY *array ;
+  ANDROID_TASK *task ;
+
+  bottom = __atomic_load_n (&deque->bottom, __ATOMIC_RELAXED) - 1 ;
+  array = __atomic_load_n (&deque->array, __ATOMIC_RELAXED) ;
+  __atomic_store_n (&deque->bottom, bottom, __ATOMIC_RELAXED) ;
+  __atomic_thread_fence (__ATOMIC_SEQ_CST) ;
+  top = __atomic_load_n (&deque->top, __ATOMIC_RELAXED) ;
+
+  task = OFC_NULL ;
+  if (top <= bottom)
+    {
+      task = __atomic_load_n (&array->tasks[bottom & (array->size - 1)],
+			      __ATOMIC_RELAXED) ;
+      if (top == bottom)
+	{
+	  /*
+	   * The last task.  Race thieves for it.
+	   */
+	  if (!__atomic_compare_exchange_n (&deque->top, &top, top + 1,
+					    OFC_FALSE, __ATOMIC_SEQ_CST,
+					    __ATOMIC_RELAXED))
+	    task = OFC_NULL ;
+	  __atomic_store_n (&deque->bottom, bottom + 1, __ATOMIC_RELAXED) ;
+	}
+    }
+  else
+    __atomic_store_n (&deque->bottom, bottom + 1, __ATOMIC_RELAXED) ;
+  return (task) ;
+}
+
+static ANDROID_TASK *android_task_steal(ANDROID_TASK_DEQUE *deque)
+{
+  OFC_INT64 bottom ;
+  OFC_INT64 top ;
+  ANDROID_TASK_ARRAY *array ;
+  ANDROID_TASK *task ;
+
+  task = OFC_NULL ;
+  top = __atomic_load_n (&deque->top, __ATOMIC_ACQUIRE) ;
+  __atomic_thread_fence (__ATOMIC_SEQ_CST) ;
+  bottom = __atomic_load_n (&deque->bottom, __ATOMIC_ACQUIRE) ;
+  if (top < bottom)
+    {
+      array = __atomic_load_n (&deque->array, __ATOMIC_ACQUIRE) ;
+      task = __atomic_load_n (&array->tasks[top & (array->size - 1)],
+			      __ATOMIC_RELAXED) ;
+      if (!__atomic_compare_exchange_n (&deque->top, &top, top + 1,
+					OFC_FALSE, __ATOMIC_SEQ_CST,
+					__ATOMIC_RELAXED))
+	task = OFC_NULL ;
+    }
+  return (task) ;
+}
+
+static ANDROID_TASK *android_task_dequeue(OFC_TASK_POOL *pool)
+{
+  ANDROID_TASK *task ;
+
+  task = OFC_NULL ;
+  if (__atomic_load_n (&pool->head, __ATOMIC_RELAXED) != OFC_NULL)
+    {
+      ofc_fast_lock (&pool->lock) ;
+      task = pool->head ;
+      if (task != OFC_NULL)
+	{
+	  __atomic_store_n (&pool->head, task->next, __ATOMIC_RELAXED) ;
+	  if (pool->head == OFC_NULL)
+	    pool->tail = OFC_NULL ;
+	}
+      ofc_fast_unlock (&pool->lock) ;
+    }
+  return (task) ;
+}
+
+/*
+ * Look for a task anywhere but the worker's own deque.  Thieves start
+ * at a random victim so they don't all pile onto the same one.
+ */
+static ANDROID_TASK *android_task_find(OFC_TASK_POOL *pool,
+				       ANDROID_TASK_WORKER *self)
+{
+  ANDROID_TASK *task ;
+  OFC_INT start ;
+  OFC_INT i ;
+  ANDROID_TASK_WORKER *victim ;
+
+  task = android_task_dequeue (pool) ;
+  if (task == OFC_NULL)
+    {
+      self->seed ^= self->seed << 13 ;
+      self->seed ^= self->seed >> 17 ;
+      self->seed ^= self->seed << 5 ;
+      start = self->seed % pool->count ;
+      for (i = 0 ; i < pool->count && task == OFC_NULL ; i++)
+	{
+	  victim = &pool->workers[(start + i) % pool->count] ;
+	  if (victim != self)
+	    task = android_task_steal (&victim->deque) ;
+	}
+    }
+  return (task) ;
+}
+
+static OFC_VOID android_task_run(ANDROID_TASK *task)
+{
+  OFC_TASK_GROUP *group ;
+
+  (task->fn)(task->context) ;
+  group = task->group ;
+  ofc_slab_free (&android_task_slab, task) ;
+  if (group != OFC_NULL &&
+      __atomic_sub_fetch (&group->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    ofc_event_set (group->hEvent) ;
+}
+
+static OFC_VOID android_task_wake(OFC_TASK_POOL *pool, OFC_INT count)
+{
+  __atomic_add_fetch (&pool->work, 1, __ATOMIC_SEQ_CST) ;
+  if (__atomic_load_n (&pool->sleepers, __ATOMIC_SEQ_CST) != 0)
+    syscall (SYS_futex, &pool->work, FUTEX_WAKE_PRIVATE, count,
+	     NULL, NULL, 0) ;
+}
+
+static OFC_DWORD android_task_worker(OFC_HANDLE hThread, OFC_VOID *context)
+{
+  ANDROID_TASK_WORKER *self ;
+  OFC_TASK_POOL *pool ;
+  ANDROID_TASK *task ;
+  OFC_UINT32 work ;
+  OFC_BOOL done ;
+
+  self = context ;
+  pool = self->pool ;
+  android_task_self = self ;
+
+  done = OFC_FALSE ;
+  while (!done)
+    {
+      task = android_task_take (&self->deque) ;
+      if (task == OFC_NULL)
+	task = android_task_find (pool, self) ;
+      if (task == OFC_NULL)
+	{
+	  /*
+	   * Say we may sleep, then look once more so a task submitted
+	   * in between either is found or moves work
+	   */
+	  work = __atomic_load_n (&pool->work, __ATOMIC_SEQ_CST) ;
+	  __atomic_add_fetch (&pool->sleepers, 1, __ATOMIC_SEQ_CST) ;
+	  task = android_task_find (pool, self) ;
+	  if (task == OFC_NULL)
+	    {
+	      if (__atomic_load_n (&pool->stop, __ATOMIC_SEQ_CST))
+		done = OFC_TRUE ;
+	      else
+		syscall (SYS_futex, &pool->work, FUTEX_WAIT_PRIVATE, work,
+			 NULL, NULL, 0) ;
+	    }
+	  __atomic_sub_fetch (&pool->sleepers, 1, __ATOMIC_SEQ_CST) ;
+	}
+      if (task != OFC_NULL)
+	android_task_run (task) ;
+    }
+
+  android_task_self = OFC_NULL ;
+  return (0) ;
+}
+
+OFC_TASK_POOL *ofc_task_pool_create(OFC_INT workers)
+{
+  OFC_TASK_POOL *pool ;
+  ANDROID_TASK_WORKER *worker ;
+  OFC_INT i ;
+  OFC_BOOL ok ;
+
+  if (workers <= 0)
+    workers = sysconf (_SC_NPROCESSORS_ONLN) ;
+  if (workers <= 0)
+    workers = 1 ;
+
+  pool = ofc_malloc (sizeof (OFC_TASK_POOL)) ;
+  if (pool == OFC_NULL)
+    return (OFC_NULL) ;
+  ofc_memset (pool, '\0', sizeof (OFC_TASK_POOL)) ;
+  ofc_fast_lock_init (&pool->lock) ;
+  pool->workers = ofc_malloc (sizeof (ANDROID_TASK_WORKER) * workers) ;
+  if (pool->workers == OFC_NULL)
+    {
+      ofc_free (pool) ;
+      return (OFC_NULL) ;
+    }
+  ofc_memset (pool->workers, '\0', sizeof (ANDROID_TASK_WORKER) * workers) ;
+  pool->count = workers ;
+
+  ok = OFC_TRUE ;
+  for (i = 0 ; i < workers && ok ; i++)
+    {
+      worker = &pool->workers[i] ;
+      worker->pool = pool ;
+      worker->seed = 2463534242U + i ;
+      worker->deque.array = android_task_array_alloc (ANDROID_TASK_DEQUE_SIZE) ;
+      if (worker->deque.array == OFC_NULL)
+	ok = OFC_FALSE ;
+    }
+
+  /*
+   * Workers steal from every deque so all must exist before any runs
+   */
+  for (i = 0 ; i < workers && ok ; i++)
+    {
+      worker = &pool->workers[i] ;
+      worker->hThread = ofc_thread_create_impl (android_task_worker,
+						"task", i, worker,
+						OFC_THREAD_JOIN,
+						OFC_HANDLE_NULL) ;
+      if (worker->hThread == OFC_HANDLE_NULL)
+	ok = OFC_FALSE ;
+      else
+	pool->started = i + 1 ;
+    }
+
+  if (!ok)
+    {
+      ofc_task_pool_destroy (pool) ;
+      pool = OFC_NULL ;
+    }
+  return (pool) ;
+}
+
+OFC_VOID ofc_task_pool_destroy(OFC_TASK_POOL *pool)
+{
+  OFC_INT i ;
+  ANDROID_TASK_WORKER *worker ;
+  ANDROID_TASK_ARRAY *array ;
+
+  __atomic_store_n (&pool->stop, OFC_TRUE, __ATOMIC_SEQ_CST) ;
+  android_task_wake (pool, INT_MAX) ;
+
+  for (i = 0 ; i < pool->started ; i++)
+    ofc_thread_wait_impl (pool->workers[i].hThread) ;
+
+  for (i = 0 ; i < pool->count ; i++)
+    {
+      worker = &pool->workers[i] ;
+      while ((array = worker->deque.array) != OFC_NULL)
+	{
+	  worker->deque.array = array->prev ;
+	  ofc_free (array) ;
+	}
+    }
+  ofc_free (pool->workers) ;
+  ofc_free (pool) ;
+}
+
+OFC_TASK_GROUP *ofc_task_group_create(OFC_HANDLE hEvent)
+{
+  OFC_TASK_GROUP *group ;
+
+  group = ofc_malloc (sizeof (OFC_TASK_GROUP)) ;
+  if (group != OFC_NULL)
+    {
+      group->pending = 1 ;
+      group->hEvent = hEvent ;
+    }
+  return (group) ;
+}
+
+OFC_VOID ofc_task_group_close(OFC_TASK_GROUP *group)
+{
+  if (__atomic_sub_fetch (&group->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    ofc_event_set (group->hEvent) ;
+}
+
+OFC_VOID ofc_task_group_destroy(OFC_TASK_GROUP *group)
+{
+  ofc_free (group) ;
+}
+
+OFC_BOOL ofc_task_submit(OFC_TASK_POOL *pool, OFC_TASK_FN *fn,
+			 OFC_VOID *context, OFC_TASK_GROUP *group)
+{
+  ANDROID_TASK *task ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  task = ofc_slab_alloc (&android_task_slab) ;
+  if (task != OFC_NULL)
+    {
+      task->fn = fn ;
+      task->context = context ;
+      task->group = group ;
+      task->next = OFC_NULL ;
+      if (group != OFC_NULL)
+	__atomic_add_fetch (&group->pending, 1, __ATOMIC_RELAXED) ;
+
+      if (android_task_self != OFC_NULL && android_task_self->pool == pool)
+	ret = android_task_push (&android_task_self->deque, task) ;
+      if (!ret)
+	{
+	  ofc_fast_lock (&pool->lock) ;
+	  if (pool->tail == OFC_NULL)
+	    __atomic_store_n (&pool->head, task, __ATOMIC_RELAXED) ;
+	  else
+	    pool->tail->next = task ;
+	  pool->tail = task ;
+	  ofc_fast_unlock (&pool->lock) ;
+	  ret = OFC_TRUE ;
+	}
+      android_task_wake (pool, 1) ;
+    }
+  return (ret) ;
+}
@@ -22,6 +22,8 @@
 #include "ofc/event.h"
 #include "ofc/heap.h"
 
+#include "ofc_android/slab_android.h"
+
 #if defined(OFC_INCLUDE_JNI)
 #include "ofc_jni/com_connectedway_io_Utils.h"
 #endif
@@ -120,6 +122,9 @@ typedef struct
   OFC_HANDLE hNotify ;
 } ANDROID_THREAD ;
 
+static OFC_SLAB android_thread_slab =
+  OFC_SLAB_INIT ("thread", sizeof (ANDROID_THREAD)) ;
+
 static void *ofc_thread_launch(void *arg) 
   __attribute__((no_instrument_function)) ;
 
@@ -152,7 +157,7 @@ static void *ofc_thread_launch(void *arg)
   if (androidThread->detachstate == OFC_THREAD_DETACH)
     {
       ofc_handle_destroy(androidThread->handle) ;
-      ofc_free(androidThread) ;
+      ofc_slab_free (&android_thread_slab, androidThread) ;
     }
   return (OFC_NULL) ;
 }
@@ -170,7 +175,7 @@ OFC_HANDLE ofc_thread_create_impl(OFC_DWORD(scheduler)(OFC_HANDLE hThread,
   pthread_attr_t attr ;
 
   ret = OFC_HANDLE_NULL ;
-  androidThread = ofc_malloc(sizeof (ANDROID_THREAD)) ;
+  androidThread = ofc_slab_alloc (&android_thread_slab) ;
   if (androidThread != OFC_NULL)
     {
       androidThread->wait_set = OFC_HANDLE_NULL ;
@@ -196,7 +201,7 @@ OFC_HANDLE ofc_thread_create_impl(OFC_DWORD(scheduler)(OFC_HANDLE hThread,
 			  ofc_thread_launch, androidThread) != 0)
 	{
 	  ofc_handle_destroy(androidThread->handle) ;
-	  ofc_free(androidThread) ;
+	  ofc_slab_free (&android_thread_slab, androidThread) ;
 	}
       else
 	ret = androidThread->handle ;
@@ -243,7 +248,7 @@ OFC_VOID ofc_thread_wait_impl(OFC_HANDLE hThread)
 	{
 	  ret = pthread_join (androidThread->thread, OFC_NULL) ;
 	  ofc_handle_destroy(androidThread->handle) ;
-	  ofc_free(androidThread) ;
+	  ofc_slab_free (&android_thread_slab, androidThread) ;
 	}
       ofc_handle_unlock(hThread) ;
     }
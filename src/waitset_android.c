@@ -6,6 +6,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <errno.h>
 
 #include "ofc/config.h"
 #include "ofc/types.h"
@@ -22,11 +28,23 @@
 #include "ofc/impl/eventimpl.h"
 
 #include "ofc/heap.h"
+#include "ofc/lock.h"
+#include "ofc/libc.h"
+#include "ofc/impl/consoleimpl.h"
 
 #include "ofc/fs.h"
 #include "ofc/file.h"
 
+#include "ofc_android/config.h"
 #include "ofc_android/fs_android.h"
+#include "ofc_android/lock_android.h"
+#include "ofc_android/socket_android.h"
+#include "ofc_android/waitset_android.h"
+#if defined(OFC_WAITSET_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 #if defined(OF_RESOLVER_FS)
 #include <dlfcn.h>
 #include "of_resolver_fs/fs_resolver.h"
@@ -38,421 +56,3531 @@
 
 /** \{ */
 
-typedef struct
+typedef enum
 {
-  int pipe_files[2] ;
-} ANDROID_WAIT_SET ;
+  ANDROID_WAIT_POLL,
+  ANDROID_WAIT_EPOLL,
+  ANDROID_WAIT_URING
+} ANDROID_WAIT_BACKEND ;
 
-OFC_VOID ofc_waitset_create_impl(WAIT_SET *pWaitSet)
+typedef struct android_wait_set ANDROID_WAIT_SET ;
+typedef struct android_wait_reg ANDROID_WAIT_REG ;
+
+typedef struct
 {
-  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *head ;
+  ANDROID_WAIT_REG *tail ;
+  OFC_UINT32 count ;
+} ANDROID_WAIT_LIST ;
 
-  AndroidWaitSet = ofc_malloc (sizeof (ANDROID_WAIT_SET)) ;
-  pWaitSet->impl = AndroidWaitSet ;
-  pipe (AndroidWaitSet->pipe_files) ;
-  fcntl (AndroidWaitSet->pipe_files[0], F_SETFL,
-	 fcntl (AndroidWaitSet->pipe_files[0], F_GETFL) | O_NONBLOCK) ;
-  fcntl (AndroidWaitSet->pipe_files[1], F_SETFL,
-	 fcntl (AndroidWaitSet->pipe_files[1], F_GETFL) | O_NONBLOCK) ;
-}
+/*
+ * Registrations are indexed by the handle added to the wait set and by
+ * the event that signals it.  A registration carries one link for each
+ * and one for the process wide index of the wait sets handles are in.
+ */
+typedef struct android_wait_link ANDROID_WAIT_LINK ;
 
-OFC_VOID ofc_waitset_destroy_impl(WAIT_SET *pWaitSet)
+struct android_wait_link
 {
-  ANDROID_WAIT_SET *AndroidWaitSet ;
+  OFC_HANDLE key ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_LINK *next ;
+} ;
 
-  AndroidWaitSet = pWaitSet->impl ;
-  close (AndroidWaitSet->pipe_files[0]) ;
-  close (AndroidWaitSet->pipe_files[1]) ;
-  ofc_free(pWaitSet->impl) ;
-  pWaitSet->impl = OFC_NULL;
-}
+typedef struct
+{
+  ANDROID_WAIT_LINK **buckets ;
+  OFC_UINT32 size ;
+  OFC_UINT32 count ;
+} ANDROID_WAIT_INDEX ;
 
+/*
+ * Handles of one priority found ready and waiting to be dispatched,
+ * oldest first.  skipped counts dispatches of higher priority handles
+ * made while this class waited.
+ */
 typedef struct
 {
+  ANDROID_WAIT_REG *head ;
+  ANDROID_WAIT_REG *tail ;
+  OFC_UINT32 skipped ;
+} ANDROID_WAIT_CLASS ;
+
+/*
+ * A handle registered with a wait set.  Registrations live from
+ * ofc_waitset_add_impl until the handle is removed, so descriptors are
+ * handed to the kernel once rather than on every wait.
+ */
+struct android_wait_reg
+{
+  /*
+   * Sockets only.  The watch installed on the socket.
+   */
+  OFC_SOCKET_WATCH watch ;
+  ANDROID_WAIT_SET *wait_set ;
+  OFC_HANDLE hWaitSet ;
+  OFC_HANDLE hHandle ;
+  OFC_HANDLE_TYPE type ;
+  /*
+   * The event whose signal means this handle may be ready.  Null for
+   * sockets, files and timers.
+   */
   OFC_HANDLE hEvent ;
-  OFC_HANDLE hAssoc ;
-} EVENT_ELEMENT ;
+  OFC_HANDLE hSocket ;
+  int fd ;
+  /*
+   * Interest mask.  Kept current for sockets by the socket watch.
+   */
+  OFC_UINT16 events ;
+  OFC_BOOL removed ;
+  /*
+   * Serial of the last wait that reported this handle
+   */
+  OFC_UINT32 serial ;
+  /*
+   * Timers only.  Cached expiration, in nanoseconds on the monotonic
+   * clock, and position in the timer heap.
+   */
+  OFC_UINT64 deadline ;
+  OFC_INT timer_index ;
+  /*
+   * io_uring backend.  Whether a poll request is outstanding and
+   * whether the registration is waiting to have one submitted.  A
+   * registration is not freed while either is true.
+   */
+  OFC_BOOL uring_pending ;
+  OFC_BOOL uring_queued ;
+  ANDROID_WAIT_REG *arm_next ;
+  /*
+   * Wait sets only.  Link on the list of nested wait sets.
+   */
+  ANDROID_WAIT_REG *nest_next ;
+  /*
+   * Dispatch class and, while the registration is queued for
+   * dispatch, the events it was found ready with
+   */
+  OFC_WAITSET_PRIORITY priority ;
+  OFC_BOOL ranked ;
+  OFC_UINT16 revents ;
+  ANDROID_WAIT_REG *rank_next ;
+  /*
+   * Grouped wait sets.  A descriptor found ready is claimed and not
+   * watched again until the thread it was handed to comes back for
+   * more.  claim_next links the claims held by that thread's wait set.
+   */
+  OFC_BOOL claimed ;
+  ANDROID_WAIT_REG *claim_next ;
+  /*
+   * Overlapped i/o.  Whether a completion has been posted and not yet
+   * reported, and the link on the completion queue.
+   */
+  OFC_BOOL completed ;
+  ANDROID_WAIT_REG *complete_next ;
+  ANDROID_WAIT_LIST *list ;
+  ANDROID_WAIT_LINK handle_link ;
+  ANDROID_WAIT_LINK event_link ;
+  ANDROID_WAIT_LINK owner_link ;
+  ANDROID_WAIT_REG *next ;
+  ANDROID_WAIT_REG *prev ;
+} ;
+
+#define ANDROID_WAIT_HASH_MIN 64
+#define ANDROID_WAIT_TIMERS_MIN 16
+#define ANDROID_WAIT_SPARE_MAX 64
+/*
+ * Smallest busy poll window, in nanoseconds, a wait set grows from
+ */
+#define ANDROID_WAIT_SPIN_MIN 10000
+#define ANDROID_WAIT_EPOLL_EVENTS 64
+/*
+ * Handles gathered per wait when dispatching by priority, and how many
+ * higher priority handles may go ahead of a waiting lower priority one
+ */
+#define ANDROID_WAIT_BATCH 64
+#define ANDROID_WAIT_AGE 4
+#define ANDROID_WAIT_SHARDS 64
+/*
+ * Size of the pending signal set (a power of two) and how far a
+ * signaller probes for a free slot before flagging an overflow
+ */
+#define ANDROID_WAIT_PENDING 128
+#define ANDROID_WAIT_PENDING_PROBE 16
 
-OFC_VOID ofc_waitset_signal_impl(OFC_HANDLE handle, OFC_HANDLE hEvent)
+#if defined(OFC_WAITSET_URING)
+#define ANDROID_WAIT_URING_ENTRIES 256
+/*
+ * Completion tags that don't name a registration.  Registrations are
+ * aligned so their low bits are clear.  Timeouts carry the serial of
+ * the wait that submitted them.
+ */
+#define ANDROID_WAIT_URING_TAG 7
+#define ANDROID_WAIT_URING_WAKE 1
+#define ANDROID_WAIT_URING_TIMER 2
+#define ANDROID_WAIT_URING_CANCEL 3
+#define ANDROID_WAIT_URING_TIMEOUT 5
+
+typedef struct
 {
-  WAIT_SET *pWaitSet ;
-  ANDROID_WAIT_SET *AndroidWaitSet ;
+  int fd ;
+  OFC_VOID *sq_ring ;
+  size_t sq_ring_size ;
+  OFC_VOID *cq_ring ;
+  size_t cq_ring_size ;
+  struct io_uring_sqe *sqes ;
+  size_t sqes_size ;
+  OFC_UINT32 *sq_head ;
+  OFC_UINT32 *sq_tail ;
+  OFC_UINT32 *sq_array ;
+  OFC_UINT32 sq_mask ;
+  OFC_UINT32 sq_entries ;
+  OFC_UINT32 *cq_head ;
+  OFC_UINT32 *cq_tail ;
+  struct io_uring_cqe *cqes ;
+  OFC_UINT32 cq_mask ;
+  /*
+   * Requests placed on the ring but not yet handed to the kernel
+   */
+  OFC_UINT32 queued ;
+  /*
+   * What the waiter submits, and whether it blocks, on its way in
+   */
+  OFC_UINT32 submit ;
+  OFC_BOOL block ;
+  /*
+   * Registrations waiting for a poll request, oldest first
+   */
+  ANDROID_WAIT_REG *arm ;
+  ANDROID_WAIT_REG *arm_tail ;
+  OFC_BOOL wake_armed ;
+  OFC_BOOL timer_armed ;
+  struct __kernel_timespec timeout ;
+} ANDROID_WAIT_RING ;
+#endif
 
-  pWaitSet = ofc_handle_lock(handle) ;
+struct android_wait_set
+{
+  /*
+   * Wake channel.  An eventfd when available, in which case both
+   * entries are the same descriptor, otherwise a pipe.
+   */
+  int wake_files[2] ;
+  OFC_BOOL wake_eventfd ;
+  /*
+   * Signals posted since the waiter last drained.  Each slot holds an
+   * event handle and a handle signalled repeatedly occupies one slot.
+   * All of these are updated without a lock.
+   */
+  OFC_HANDLE pending[ANDROID_WAIT_PENDING] ;
+  OFC_BOOL pending_overflow ;
+  OFC_BOOL pending_wake ;
+  /*
+   * Set once something has been signalled and cleared by the waiter
+   * when it drains.  Keeps signallers from writing more than once per
+   * drain.  The wake channel is only written while the waiter says it
+   * is sleeping, since it looks for signals before it sleeps, and
+   * written records that it was.
+   */
+  OFC_BOOL notified ;
+  OFC_BOOL sleeping ;
+  OFC_BOOL written ;
+  ANDROID_WAIT_BACKEND backend ;
+  int epoll_fd ;
+  /*
+   * Protects the registrations.  Adds and removes can come from
+   * threads other than the one waiting.
+   */
+  OFC_LOCK lock ;
+  ANDROID_WAIT_INDEX handles ;
+  ANDROID_WAIT_INDEX events ;
+  /*
+   * Sockets and files
+   */
+  ANDROID_WAIT_LIST fd_list ;
+  /*
+   * Events, wait queues and overlapped i/o.  Only those signalled
+   * through the pending set are tested.
+   */
+  ANDROID_WAIT_LIST event_list ;
+  /*
+   * Overlapped i/o whose file system posts its completions.  These
+   * aren't tested on each wait.  They are reported from the completion
+   * queue, in the order they completed.
+   */
+  ANDROID_WAIT_LIST posted_list ;
+  ANDROID_WAIT_REG *completed_head ;
+  ANDROID_WAIT_REG *completed_tail ;
+  /*
+   * Timers, kept in a min heap on their deadlines.  Setting a timer
+   * wakes the wait set it is in, so the deadlines are refreshed only
+   * after the wait set has been woken.
+   */
+  ANDROID_WAIT_LIST timer_list ;
+  ANDROID_WAIT_REG **timers ;
+  OFC_INT timer_count ;
+  OFC_INT timer_size ;
+  OFC_BOOL timers_stale ;
+  /*
+   * Timer descriptor armed to the earliest deadline, or -1 if timers
+   * are enforced by the wait timeout.  timer_armed is the deadline it
+   * is armed for, zero when disarmed.
+   */
+  int timer_fd ;
+  OFC_UINT64 timer_armed ;
+  /*
+   * Fairness.  The event list walk starts at the cursor, the pending
+   * drain at pending_rotor and the poll scan at the rotor, each left
+   * just past the last handle reported.
+   * fd_starved is set when a wait was satisfied before descriptors
+   * were looked at so the next wait looks at them first.
+   */
+  ANDROID_WAIT_REG *cursor ;
+  OFC_UINT32 pending_rotor ;
+  nfds_t rotor ;
+  OFC_BOOL fd_starved ;
+  /*
+   * Removed registrations.  The waiter may still be looking at these
+   * so they are freed at the start of the next wait.
+   */
+  ANDROID_WAIT_REG *zombies ;
+  /*
+   * Freed registrations kept for reuse so adds and removes don't go
+   * to the heap
+   */
+  ANDROID_WAIT_REG *spare ;
+  OFC_UINT32 spare_count ;
+  OFC_UINT32 serial ;
+  /*
+   * Poll backend.  The descriptor list is rebuilt only when the
+   * registrations change.
+   */
+  OFC_BOOL dirty ;
+  struct pollfd *poll_list ;
+  ANDROID_WAIT_REG **poll_regs ;
+  nfds_t poll_count ;
+  nfds_t poll_size ;
+  /*
+   * Epoll backend
+   */
+  struct epoll_event epoll_events[ANDROID_WAIT_EPOLL_EVENTS] ;
+#if defined(OFC_WAITSET_URING)
+  /*
+   * io_uring backend
+   */
+  ANDROID_WAIT_RING uring ;
+#endif
+  /*
+   * Statistics.  signal_stamp is when the wake channel was first
+   * written since the waiter last drained it and is set without the
+   * lock.  signal_since is the stamp drained by the current wait.
+   */
+  OFC_WAITSET_STATS stats ;
+  OFC_UINT64 signal_stamp ;
+  OFC_UINT64 signal_since ;
+  /*
+   * Busy polling.  The longest and current windows in nanoseconds.
+   * The current window is only touched by the waiter.
+   */
+  OFC_UINT64 spin_max ;
+  OFC_UINT64 spin_budget ;
+  /*
+   * Nesting.  The wait set this one was last added to and our own
+   * handle so we can leave it when destroyed.  nested lists the wait
+   * sets added to us.
+   */
+  OFC_HANDLE hParent ;
+  OFC_HANDLE hSelf ;
+  ANDROID_WAIT_REG *nested ;
+  /*
+   * Priorities.  While any registration is above or below normal, or
+   * any handle is waiting in a class, waits gather ready handles into
+   * the batch and dispatch them from the classes.
+   */
+  OFC_UINT32 prioritized ;
+  OFC_UINT32 ranked ;
+  ANDROID_WAIT_CLASS classes[OFC_WAITSET_PRIORITIES] ;
+  OFC_WAITSET_READY batch[ANDROID_WAIT_BATCH] ;
+  ANDROID_WAIT_REG *batch_regs[ANDROID_WAIT_BATCH] ;
+  /*
+   * Sharding.  The group we're in, whether our waiter is asleep, the
+   * claims our waiter holds and how many claimed handles are queued
+   * waiting for someone to take them.
+   */
+  OFC_WAITSET_GROUP *group ;
+  OFC_BOOL parked ;
+  ANDROID_WAIT_REG *claims ;
+  OFC_UINT32 stealable ;
+} ;
 
-  if (pWaitSet != OFC_NULL)
-    {
-      AndroidWaitSet = pWaitSet->impl ;
-      write (AndroidWaitSet->pipe_files[1], &hEvent, sizeof (OFC_HANDLE)) ;
-      ofc_handle_unlock(handle) ;
-    }
+/*
+ * Wait sets sharing their ready handles.  Claimed registrations of a
+ * destroyed wait set are orphaned here until released.
+ */
+struct ofc_waitset_group
+{
+  OFC_LOCK lock ;
+  ANDROID_WAIT_SET *shards[ANDROID_WAIT_SHARDS] ;
+  OFC_HANDLE handles[ANDROID_WAIT_SHARDS] ;
+  OFC_INT count ;
+  OFC_UINT32 rotor ;
+  ANDROID_WAIT_REG *orphans ;
+} ;
+
+static OFC_VOID android_wait_notify(ANDROID_WAIT_SET *AndroidWaitSet) ;
+static OFC_VOID android_wait_group_leave(ANDROID_WAIT_SET *AndroidWaitSet) ;
+
+/*
+ * Every registration by the handle it is for.  The core drops a
+ * handle's association with its wait set before telling us, so this is
+ * how the registration it leaves behind is found.  Taken with a wait
+ * set locked, never the other way round.
+ */
+static OFC_FAST_LOCK android_wait_owner_lock = OFC_FAST_LOCK_INIT ;
+static ANDROID_WAIT_INDEX android_wait_owners ;
+
+static OFC_UINT32 android_wait_hash(OFC_HANDLE handle, OFC_UINT32 size)
+{
+  OFC_DWORD_PTR key ;
+
+  key = (OFC_DWORD_PTR) handle ;
+  key ^= key >> 16 ;
+  key *= 0x45d9f3b ;
+  key ^= key >> 16 ;
+
+  return ((OFC_UINT32) key & (size - 1)) ;
 }
 
-OFC_VOID ofc_waitset_wake_impl(OFC_HANDLE handle)
+static OFC_VOID android_wait_index_init(ANDROID_WAIT_INDEX *index)
 {
-  ofc_waitset_signal_impl(handle, OFC_HANDLE_NULL) ;
+  OFC_UINT32 i ;
+
+  index->size = ANDROID_WAIT_HASH_MIN ;
+  index->count = 0 ;
+  index->buckets = ofc_malloc (sizeof (ANDROID_WAIT_LINK *) * index->size) ;
+  for (i = 0 ; i < index->size ; i++)
+    index->buckets[i] = OFC_NULL ;
 }
 
-OFC_HANDLE PollEvent (OFC_INT fd, OFC_HANDLE eventQueue)
+static ANDROID_WAIT_REG *android_wait_index_find(ANDROID_WAIT_INDEX *index,
+						 OFC_HANDLE key)
 {
-  EVENT_ELEMENT *eventElement ;
-  OFC_HANDLE hEvent ;
-  OFC_HANDLE triggered_event ;
-  OFC_INT size ;
-  OFC_BOOL wake ;
-  /*
-   * Special case.  It's the pipe.  Let's read the
-   * event handle
-   */
-  triggered_event = OFC_HANDLE_NULL ;
-  wake = OFC_FALSE ;
+  ANDROID_WAIT_LINK *link ;
+
+  for (link = index->buckets[android_wait_hash(key, index->size)] ;
+       link != OFC_NULL && link->key != key ;
+       link = link->next) ;
+
+  return (link == OFC_NULL ? OFC_NULL : link->reg) ;
+}
 
-  do
+static OFC_VOID android_wait_index_insert(ANDROID_WAIT_INDEX *index,
+					  ANDROID_WAIT_LINK *link)
+{
+  ANDROID_WAIT_LINK **buckets ;
+  ANDROID_WAIT_LINK *move ;
+  OFC_UINT32 size ;
+  OFC_UINT32 i ;
+  OFC_UINT32 bucket ;
+
+  if (index->count >= index->size)
     {
-      size = read (fd, &hEvent, sizeof(OFC_HANDLE)) ;
-      if (size == sizeof (OFC_HANDLE))
+      /*
+       * Keep the chains short.  Double the table and rehash
+       */
+      size = index->size * 2 ;
+      buckets = ofc_malloc (sizeof (ANDROID_WAIT_LINK *) * size) ;
+      if (buckets != OFC_NULL)
 	{
-	  if (hEvent == OFC_HANDLE_NULL)
-	    wake = OFC_TRUE ;
-	  else
-	    {
-	      for (eventElement = ofc_queue_first(eventQueue) ;
-		   eventElement != OFC_NULL && eventElement->hEvent != hEvent ;
-		   eventElement = ofc_queue_next(eventQueue, eventElement) ) ;
+	  for (i = 0 ; i < size ; i++)
+	    buckets[i] = OFC_NULL ;
 
-	      if (eventElement != OFC_NULL)
+	  for (i = 0 ; i < index->size ; i++)
+	    {
+	      while (index->buckets[i] != OFC_NULL)
 		{
-		  if (ofc_event_test(hEvent) == OFC_TRUE)
-		    {
-		      if (ofc_event_get_type(hEvent) == OFC_EVENT_AUTO)
-			ofc_event_reset(hEvent) ;
-		      triggered_event = eventElement->hAssoc ;
-		    }
+		  move = index->buckets[i] ;
+		  index->buckets[i] = move->next ;
+		  bucket = android_wait_hash(move->key, size) ;
+		  move->next = buckets[bucket] ;
+		  buckets[bucket] = move ;
 		}
 	    }
+	  ofc_free (index->buckets) ;
+	  index->buckets = buckets ;
+	  index->size = size ;
 	}
     }
-  while (triggered_event == OFC_HANDLE_NULL && !wake &&
-	 size == sizeof (OFC_HANDLE)) ;
 
-  return (triggered_event);
+  bucket = android_wait_hash(link->key, index->size) ;
+  link->next = index->buckets[bucket] ;
+  index->buckets[bucket] = link ;
+  index->count++ ;
 }
 
-#if defined(OF_RESOLVER_FS)
-typedef OFC_HANDLE (*getEventHandleFunc)(OFC_HANDLE parentHandle);
+static OFC_VOID android_wait_index_remove(ANDROID_WAIT_INDEX *index,
+					  ANDROID_WAIT_LINK *link)
+{
+  ANDROID_WAIT_LINK **prev ;
+
+  for (prev = &index->buckets[android_wait_hash(link->key, index->size)] ;
+       *prev != OFC_NULL && *prev != link ;
+       prev = &(*prev)->next) ;
+
+  if (*prev != OFC_NULL)
+    {
+      *prev = link->next ;
+      index->count-- ;
+    }
+  link->next = OFC_NULL ;
+}
 
 /*
- * Resolver requires JNI.  It is a reverse JNI module
- * that lets us call back into the Java App.
- * The problem is, we build the android waitset into
- * the core.  It is not linked with the JNI layer.
- * So, even though we would hope we can do dynamic linking
- * the build will fail if we call the resolver here.  So,
- * let's see if we can do our own dynamic binding
+ * Called with the registration's wait set locked
  */
-static OFC_HANDLE
-ofc_android_get_resolver_overlapped_event(OFC_HANDLE hEventHandle)
+static OFC_VOID android_wait_owner_insert(ANDROID_WAIT_REG *reg)
 {
-  OFC_HANDLE hEvent;
-  
-  static getEventHandleFunc overlapped_function = OFC_NULL;
+  reg->owner_link.key = reg->hHandle ;
+  reg->owner_link.reg = reg ;
+  ofc_fast_lock (&android_wait_owner_lock) ;
+  if (android_wait_owners.buckets == OFC_NULL)
+    android_wait_index_init(&android_wait_owners) ;
+  android_wait_index_insert(&android_wait_owners, &reg->owner_link) ;
+  ofc_fast_unlock (&android_wait_owner_lock) ;
+}
 
-  if (overlapped_function == OFC_NULL)
+/*
+ * Called with the registration's wait set locked
+ */
+static OFC_VOID android_wait_owner_remove(ANDROID_WAIT_REG *reg)
+{
+  ofc_fast_lock (&android_wait_owner_lock) ;
+  android_wait_index_remove(&android_wait_owners, &reg->owner_link) ;
+  ofc_fast_unlock (&android_wait_owner_lock) ;
+}
+
+/*
+ * Find a wait set other than hSet that a handle is registered with
+ */
+static OFC_HANDLE android_wait_owner_find(OFC_HANDLE hEvent,
+					  OFC_HANDLE hSet)
+{
+  ANDROID_WAIT_LINK *link ;
+  OFC_UINT32 bucket ;
+  OFC_HANDLE hOwner ;
+
+  ofc_fast_lock (&android_wait_owner_lock) ;
+  link = OFC_NULL ;
+  if (android_wait_owners.buckets != OFC_NULL)
     {
-      /*
-       * Bind to the function
-       */
-      overlapped_function =
-        (getEventHandleFunc) dlsym(RTLD_DEFAULT,
-                                   "OfcFSResolverGetOverlappedEvent");
-      if (overlapped_function == OFC_NULL)
-        {
-          ofc_process_crash(dlerror());
-        }
+      bucket = android_wait_hash(hEvent, android_wait_owners.size) ;
+      link = android_wait_owners.buckets[bucket] ;
     }
+  for ( ; link != OFC_NULL &&
+	  (link->key != hEvent || link->reg->hWaitSet == hSet) ;
+	link = link->next) ;
+  hOwner = (link == OFC_NULL ? OFC_HANDLE_NULL : link->reg->hWaitSet) ;
+  ofc_fast_unlock (&android_wait_owner_lock) ;
 
-  hEvent = overlapped_function(hEventHandle);
-  return (hEvent);
+  return (hOwner) ;
 }
-#endif
 
-OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
+static OFC_VOID android_wait_list_append(ANDROID_WAIT_LIST *list,
+					 ANDROID_WAIT_REG *reg)
 {
-  WAIT_SET *pWaitSet ;
-  ANDROID_WAIT_SET *AndroidWaitSet ;
+  reg->next = OFC_NULL ;
+  reg->prev = list->tail ;
+  if (list->tail != OFC_NULL)
+    list->tail->next = reg ;
+  else
+    list->head = reg ;
+  list->tail = reg ;
+  list->count++ ;
+}
 
-  OFC_HANDLE hEvent ;
-  OFC_HANDLE hEventHandle ;
-  OFC_HANDLE triggered_event ;
-  OFC_HANDLE timer_event ;
-  OFC_HANDLE androidHandle ;
-#if defined(OFC_FS_ANDROID)
-  OFC_HANDLE fsHandle ;
-#endif
-  struct pollfd *android_handle_list ;
-  OFC_HANDLE *ofc_handle_list ;
+static OFC_VOID android_wait_list_remove(ANDROID_WAIT_LIST *list,
+					 ANDROID_WAIT_REG *reg)
+{
+  if (reg->prev != OFC_NULL)
+    reg->prev->next = reg->next ;
+  else
+    list->head = reg->next ;
+  if (reg->next != OFC_NULL)
+    reg->next->prev = reg->prev ;
+  else
+    list->tail = reg->prev ;
+  reg->next = OFC_NULL ;
+  reg->prev = OFC_NULL ;
+  list->count-- ;
+}
 
-  nfds_t wait_count ;
-  int wait_index ;
-  int leastWait ;
+/*
+ * Timer deadlines are kept on the monotonic clock so they don't move
+ * when the wall clock is set
+ */
+static OFC_UINT64 android_wait_clock(OFC_VOID)
+{
+  struct timespec ts ;
 
-  int poll_count ;
-  OFC_MSTIME wait_time ;
-#if defined(OFC_FS_ANDROID)
-  OFC_FST_TYPE fsType ;
-#endif
-  OFC_HANDLE eventQueue ;
-  EVENT_ELEMENT *eventElement ;
-  OFC_HANDLE hWaitQ;
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+  return ((OFC_UINT64) ts.tv_sec * 1000000000 + ts.tv_nsec) ;
+}
 
-  triggered_event = OFC_HANDLE_NULL ;
-  pWaitSet = ofc_handle_lock(handle) ;
+static OFC_BOOL android_wait_before(OFC_UINT64 a, OFC_UINT64 b)
+{
+  return (a < b) ;
+}
+
+static OFC_VOID android_wait_timer_place(ANDROID_WAIT_SET *AndroidWaitSet,
+					 OFC_INT index, ANDROID_WAIT_REG *reg)
+{
+  AndroidWaitSet->timers[index] = reg ;
+  reg->timer_index = index ;
+}
+
+static OFC_VOID android_wait_timer_up(ANDROID_WAIT_SET *AndroidWaitSet,
+				      OFC_INT index)
+{
+  ANDROID_WAIT_REG *reg ;
+  OFC_INT parent ;
+
+  reg = AndroidWaitSet->timers[index] ;
+  while (index > 0)
+    {
+      parent = (index - 1) / 2 ;
+      if (!android_wait_before(reg->deadline,
+			       AndroidWaitSet->timers[parent]->deadline))
+	break ;
+      android_wait_timer_place(AndroidWaitSet, index,
+			       AndroidWaitSet->timers[parent]) ;
+      index = parent ;
+    }
+  android_wait_timer_place(AndroidWaitSet, index, reg) ;
+}
+
+static OFC_VOID android_wait_timer_down(ANDROID_WAIT_SET *AndroidWaitSet,
+					OFC_INT index)
+{
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG **timers ;
+  OFC_INT child ;
+
+  timers = AndroidWaitSet->timers ;
+  reg = timers[index] ;
+  for (child = index * 2 + 1 ; child < AndroidWaitSet->timer_count ;
+       child = index * 2 + 1)
+    {
+      if (child + 1 < AndroidWaitSet->timer_count &&
+	  android_wait_before(timers[child + 1]->deadline,
+			      timers[child]->deadline))
+	child++ ;
+      if (!android_wait_before(timers[child]->deadline, reg->deadline))
+	break ;
+      android_wait_timer_place(AndroidWaitSet, index, timers[child]) ;
+      index = child ;
+    }
+  android_wait_timer_place(AndroidWaitSet, index, reg) ;
+}
+
+static OFC_VOID android_wait_timer_insert(ANDROID_WAIT_SET *AndroidWaitSet,
+					  ANDROID_WAIT_REG *reg)
+{
+  if (AndroidWaitSet->timer_count == AndroidWaitSet->timer_size)
+    {
+      AndroidWaitSet->timer_size *= 2 ;
+      if (AndroidWaitSet->timer_size < ANDROID_WAIT_TIMERS_MIN)
+	AndroidWaitSet->timer_size = ANDROID_WAIT_TIMERS_MIN ;
+      AndroidWaitSet->timers =
+	ofc_realloc (AndroidWaitSet->timers,
+		     sizeof (ANDROID_WAIT_REG *) * AndroidWaitSet->timer_size) ;
+    }
+  android_wait_timer_place(AndroidWaitSet, AndroidWaitSet->timer_count++,
+			   reg) ;
+  android_wait_timer_up(AndroidWaitSet, reg->timer_index) ;
+}
+
+static OFC_VOID android_wait_timer_remove(ANDROID_WAIT_SET *AndroidWaitSet,
+					  ANDROID_WAIT_REG *reg)
+{
+  ANDROID_WAIT_REG *last ;
+
+  AndroidWaitSet->timer_count-- ;
+  last = AndroidWaitSet->timers[AndroidWaitSet->timer_count] ;
+  if (last != reg)
+    {
+      android_wait_timer_place(AndroidWaitSet, reg->timer_index, last) ;
+      android_wait_timer_up(AndroidWaitSet, last->timer_index) ;
+      android_wait_timer_down(AndroidWaitSet, last->timer_index) ;
+    }
+  reg->timer_index = -1 ;
+}
+
+/*
+ * Reread every timer's expiration and reorder the heap
+ */
+static OFC_VOID android_wait_timer_refresh(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  ANDROID_WAIT_REG *reg ;
+  OFC_UINT64 now ;
+  OFC_INT index ;
+
+  now = android_wait_clock() ;
+  for (index = 0 ; index < AndroidWaitSet->timer_count ; index++)
+    {
+      reg = AndroidWaitSet->timers[index] ;
+      reg->deadline = now +
+	(OFC_UINT64) ofc_timer_get_wait_time(reg->hHandle) * 1000000 ;
+    }
+  for (index = AndroidWaitSet->timer_count / 2 - 1 ; index >= 0 ; index--)
+    android_wait_timer_down(AndroidWaitSet, index) ;
+  AndroidWaitSet->timers_stale = OFC_FALSE ;
+}
+
+#if defined(OFC_WAITSET_URING)
+static OFC_VOID android_wait_uring_close(ANDROID_WAIT_RING *uring)
+{
+  if (uring->sq_ring != MAP_FAILED)
+    munmap (uring->sq_ring, uring->sq_ring_size) ;
+  if (uring->cq_ring != MAP_FAILED)
+    munmap (uring->cq_ring, uring->cq_ring_size) ;
+  if (uring->sqes != MAP_FAILED)
+    munmap (uring->sqes, uring->sqes_size) ;
+  if (uring->fd != -1)
+    close (uring->fd) ;
+  uring->fd = -1 ;
+}
+
+/*
+ * Set up a ring.  Fails on kernels without io_uring or where it has
+ * been disabled.
+ */
+static OFC_BOOL android_wait_uring_open(ANDROID_WAIT_RING *uring)
+{
+  struct io_uring_params params ;
+  OFC_CHAR *sq_ring ;
+  OFC_CHAR *cq_ring ;
+
+  uring->sq_ring = MAP_FAILED ;
+  uring->cq_ring = MAP_FAILED ;
+  uring->sqes = MAP_FAILED ;
+  uring->queued = 0 ;
+  uring->submit = 0 ;
+  uring->block = OFC_FALSE ;
+  uring->arm = OFC_NULL ;
+  uring->arm_tail = OFC_NULL ;
+  uring->wake_armed = OFC_FALSE ;
+  uring->timer_armed = OFC_FALSE ;
+
+  ofc_memset (&params, '\0', sizeof (params)) ;
+  uring->fd = syscall (__NR_io_uring_setup, ANDROID_WAIT_URING_ENTRIES,
+		       &params) ;
+  if (uring->fd < 0)
+    {
+      uring->fd = -1 ;
+      return (OFC_FALSE) ;
+    }
+
+  uring->sq_ring_size = params.sq_off.array +
+    params.sq_entries * sizeof (OFC_UINT32) ;
+  uring->cq_ring_size = params.cq_off.cqes +
+    params.cq_entries * sizeof (struct io_uring_cqe) ;
+  uring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe) ;
+
+  uring->sq_ring = mmap (OFC_NULL, uring->sq_ring_size,
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 uring->fd, IORING_OFF_SQ_RING) ;
+  uring->cq_ring = mmap (OFC_NULL, uring->cq_ring_size,
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 uring->fd, IORING_OFF_CQ_RING) ;
+  uring->sqes = mmap (OFC_NULL, uring->sqes_size,
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      uring->fd, IORING_OFF_SQES) ;
+  if (uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED ||
+      uring->sqes == MAP_FAILED)
+    {
+      android_wait_uring_close(uring) ;
+      return (OFC_FALSE) ;
+    }
+
+  sq_ring = uring->sq_ring ;
+  uring->sq_head = (OFC_UINT32 *) (sq_ring + params.sq_off.head) ;
+  uring->sq_tail = (OFC_UINT32 *) (sq_ring + params.sq_off.tail) ;
+  uring->sq_array = (OFC_UINT32 *) (sq_ring + params.sq_off.array) ;
+  uring->sq_mask = *(OFC_UINT32 *) (sq_ring + params.sq_off.ring_mask) ;
+  uring->sq_entries = params.sq_entries ;
+
+  cq_ring = uring->cq_ring ;
+  uring->cq_head = (OFC_UINT32 *) (cq_ring + params.cq_off.head) ;
+  uring->cq_tail = (OFC_UINT32 *) (cq_ring + params.cq_off.tail) ;
+  uring->cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes) ;
+  uring->cq_mask = *(OFC_UINT32 *) (cq_ring + params.cq_off.ring_mask) ;
+
+  return (OFC_TRUE) ;
+}
+
+static int android_wait_uring_enter(ANDROID_WAIT_RING *uring,
+				    OFC_UINT32 submit, OFC_UINT32 complete)
+{
+  return (syscall (__NR_io_uring_enter, uring->fd, submit, complete,
+		   complete > 0 ? IORING_ENTER_GETEVENTS : 0, OFC_NULL, 0)) ;
+}
+
+/*
+ * Called with the wait set locked.  Returns a cleared submission entry
+ * or null if the ring is full even after handing it to the kernel.
+ * The entry is published by android_wait_uring_commit.
+ */
+static struct io_uring_sqe *
+android_wait_uring_sqe(ANDROID_WAIT_RING *uring)
+{
+  struct io_uring_sqe *sqe ;
+  OFC_UINT32 tail ;
+
+  sqe = OFC_NULL ;
+  tail = *uring->sq_tail ;
+  if (tail - __atomic_load_n (uring->sq_head, __ATOMIC_ACQUIRE) ==
+      uring->sq_entries)
+    {
+      android_wait_uring_enter(uring, uring->queued, 0) ;
+      uring->queued = 0 ;
+    }
+  if (tail - __atomic_load_n (uring->sq_head, __ATOMIC_ACQUIRE) <
+      uring->sq_entries)
+    {
+      sqe = &uring->sqes[tail & uring->sq_mask] ;
+      ofc_memset (sqe, '\0', sizeof (struct io_uring_sqe)) ;
+    }
+  return (sqe) ;
+}
+
+static OFC_VOID android_wait_uring_commit(ANDROID_WAIT_RING *uring)
+{
+  OFC_UINT32 tail ;
+
+  tail = *uring->sq_tail ;
+  uring->sq_array[tail & uring->sq_mask] = tail & uring->sq_mask ;
+  __atomic_store_n (uring->sq_tail, tail + 1, __ATOMIC_RELEASE) ;
+  uring->queued++ ;
+}
+
+static OFC_BOOL android_wait_uring_poll(ANDROID_WAIT_RING *uring,
+					OFC_UINT64 tag, int fd,
+					OFC_UINT16 events)
+{
+  struct io_uring_sqe *sqe ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sqe = android_wait_uring_sqe(uring) ;
+  if (sqe != OFC_NULL)
+    {
+      sqe->opcode = IORING_OP_POLL_ADD ;
+      sqe->fd = fd ;
+      sqe->poll_events = events ;
+      sqe->user_data = tag ;
+      android_wait_uring_commit(uring) ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Called with the wait set locked.  Queue a registration to have a
+ * poll request submitted by the waiter.
+ */
+static OFC_VOID android_wait_uring_queue(ANDROID_WAIT_SET *AndroidWaitSet,
+					 ANDROID_WAIT_REG *reg)
+{
+  ANDROID_WAIT_RING *uring ;
+
+  uring = &AndroidWaitSet->uring ;
+  if (!reg->uring_queued)
+    {
+      reg->uring_queued = OFC_TRUE ;
+      reg->arm_next = OFC_NULL ;
+      if (uring->arm_tail != OFC_NULL)
+	uring->arm_tail->arm_next = reg ;
+      else
+	uring->arm = reg ;
+      uring->arm_tail = reg ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Cancel a registration's poll
+ * request.  This is submitted right away so the kernel lets go of the
+ * descriptor before it can be closed.
+ */
+static OFC_VOID android_wait_uring_cancel(ANDROID_WAIT_SET *AndroidWaitSet,
+					  ANDROID_WAIT_REG *reg)
+{
+  ANDROID_WAIT_RING *uring ;
+  struct io_uring_sqe *sqe ;
+
+  uring = &AndroidWaitSet->uring ;
+  if (reg->uring_pending)
+    {
+      sqe = android_wait_uring_sqe(uring) ;
+      if (sqe != OFC_NULL)
+	{
+	  sqe->opcode = IORING_OP_POLL_REMOVE ;
+	  sqe->addr = (OFC_UINT64) (OFC_DWORD_PTR) reg ;
+	  sqe->user_data = ANDROID_WAIT_URING_CANCEL ;
+	  android_wait_uring_commit(uring) ;
+	  android_wait_uring_enter(uring, uring->queued, 0) ;
+	  uring->queued = 0 ;
+	}
+    }
+}
+#endif
+
+/*
+ * Called with the wait set locked.  Queue a ready registration on its
+ * dispatch class.
+ */
+static OFC_VOID android_wait_rank_reg(ANDROID_WAIT_SET *AndroidWaitSet,
+				      ANDROID_WAIT_REG *reg,
+				      OFC_UINT16 revents)
+{
+  ANDROID_WAIT_CLASS *rank ;
+
+  reg->ranked = OFC_TRUE ;
+  reg->revents = revents ;
+  reg->rank_next = OFC_NULL ;
+  rank = &AndroidWaitSet->classes[reg->priority] ;
+  if (rank->tail == OFC_NULL)
+    rank->head = reg ;
+  else
+    rank->tail->rank_next = reg ;
+  rank->tail = reg ;
+  AndroidWaitSet->ranked++ ;
+}
+
+/*
+ * Called with the wait set locked.  Take a registration off its
+ * dispatch class.
+ */
+static OFC_VOID android_wait_unrank(ANDROID_WAIT_SET *AndroidWaitSet,
+				    ANDROID_WAIT_REG *reg)
+{
+  ANDROID_WAIT_CLASS *rank ;
+  ANDROID_WAIT_REG **link ;
+  ANDROID_WAIT_REG *prev ;
+
+  rank = &AndroidWaitSet->classes[reg->priority] ;
+  prev = OFC_NULL ;
+  for (link = &rank->head ; *link != OFC_NULL && *link != reg ;
+       link = &(*link)->rank_next)
+    prev = *link ;
+  if (*link != OFC_NULL)
+    {
+      *link = reg->rank_next ;
+      if (rank->tail == reg)
+	rank->tail = prev ;
+    }
+  reg->ranked = OFC_FALSE ;
+  AndroidWaitSet->ranked-- ;
+}
+
+/*
+ * Called with the wait set that owns the registration locked.  Watch
+ * a claimed descriptor again.  The owner is woken if it isn't the
+ * wait set releasing the claim, since it may be asleep without the
+ * descriptor.
+ */
+static OFC_VOID android_wait_rearm(ANDROID_WAIT_SET *AndroidWaitSet,
+				   ANDROID_WAIT_REG *reg,
+				   ANDROID_WAIT_SET *releaser)
+{
+  struct epoll_event event ;
+
+  reg->claimed = OFC_FALSE ;
+  if (!reg->removed && reg->fd != -1)
+    {
+      if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL)
+	{
+	  event.events = reg->events ;
+	  if (AndroidWaitSet->group != OFC_NULL)
+	    event.events |= EPOLLONESHOT ;
+	  event.data.ptr = reg ;
+	  epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_MOD, reg->fd, &event) ;
+	}
+      else
+	{
+#if defined(OFC_WAITSET_URING)
+	  if (AndroidWaitSet->backend == ANDROID_WAIT_URING &&
+	      !reg->uring_pending && !reg->uring_queued)
+	    android_wait_uring_queue(AndroidWaitSet, reg) ;
+#endif
+	  if (AndroidWaitSet != releaser)
+	    android_wait_notify(AndroidWaitSet) ;
+	}
+    }
+}
+
+/*
+ * Called with the wait set locked.  The registration is parked on the
+ * zombie list until the next wait since the waiter may hold a pointer
+ * to it from the kernel's ready list.
+ */
+static OFC_VOID android_wait_release(ANDROID_WAIT_SET *AndroidWaitSet,
+				     ANDROID_WAIT_REG *reg)
+{
+  ANDROID_WAIT_REG **link ;
+
+  android_wait_index_remove(&AndroidWaitSet->handles, &reg->handle_link) ;
+  if (reg->hEvent != OFC_HANDLE_NULL)
+    android_wait_index_remove(&AndroidWaitSet->events, &reg->event_link) ;
+  android_wait_owner_remove(reg) ;
+  if (AndroidWaitSet->cursor == reg)
+    AndroidWaitSet->cursor = reg->next ;
+  android_wait_list_remove(reg->list, reg) ;
+  if (reg->timer_index != -1)
+    android_wait_timer_remove(AndroidWaitSet, reg) ;
+
+  if (reg->hSocket != OFC_HANDLE_NULL)
+    ofc_socket_impl_unwatch(reg->hSocket, &reg->watch) ;
+
+  if (reg->priority != OFC_WAITSET_PRIORITY_NORMAL)
+    AndroidWaitSet->prioritized-- ;
+  if (reg->ranked)
+    {
+      /*
+       * Nobody has been handed it yet so nobody holds the claim
+       */
+      android_wait_unrank(AndroidWaitSet, reg) ;
+      if (reg->claimed)
+	{
+	  reg->claimed = OFC_FALSE ;
+	  AndroidWaitSet->stealable-- ;
+	}
+    }
+
+  if (reg->type == OFC_HANDLE_WAIT_SET)
+    {
+      for (link = &AndroidWaitSet->nested ;
+	   *link != OFC_NULL && *link != reg ;
+	   link = &(*link)->nest_next) ;
+      if (*link != OFC_NULL)
+	*link = reg->nest_next ;
+    }
+
+  if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL && reg->fd != -1)
+    epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_DEL, reg->fd, OFC_NULL) ;
+#if defined(OFC_WAITSET_URING)
+  if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+    android_wait_uring_cancel(AndroidWaitSet, reg) ;
+#endif
+  reg->fd = -1 ;
+
+  reg->removed = OFC_TRUE ;
+  reg->next = AndroidWaitSet->zombies ;
+  AndroidWaitSet->zombies = reg ;
+  AndroidWaitSet->dirty = OFC_TRUE ;
+}
+
+/*
+ * Free removed registrations, keeping some for reuse.  Unless all is
+ * set, registrations the io_uring backend still has requests for, that
+ * another wait set's waiter holds a claim on, or that are on the
+ * completion queue, are kept until they're done with.
+ */
+static OFC_VOID android_wait_reap(ANDROID_WAIT_SET *AndroidWaitSet,
+				  OFC_BOOL all)
+{
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *keep ;
+
+  keep = OFC_NULL ;
+  while (AndroidWaitSet->zombies != OFC_NULL)
+    {
+      reg = AndroidWaitSet->zombies ;
+      AndroidWaitSet->zombies = reg->next ;
+      if (!all && (reg->uring_pending || reg->uring_queued ||
+		   reg->claimed || reg->completed))
+	{
+	  reg->next = keep ;
+	  keep = reg ;
+	}
+      else if (!all && AndroidWaitSet->spare_count < ANDROID_WAIT_SPARE_MAX)
+	{
+	  reg->next = AndroidWaitSet->spare ;
+	  AndroidWaitSet->spare = reg ;
+	  AndroidWaitSet->spare_count++ ;
+	}
+      else
+	ofc_free (reg) ;
+    }
+  AndroidWaitSet->zombies = keep ;
+
+  if (all)
+    {
+      while (AndroidWaitSet->spare != OFC_NULL)
+	{
+	  reg = AndroidWaitSet->spare ;
+	  AndroidWaitSet->spare = reg->next ;
+	  ofc_free (reg) ;
+	}
+      AndroidWaitSet->spare_count = 0 ;
+    }
+}
+
+/*
+ * Called with the wait set locked
+ */
+static ANDROID_WAIT_REG *android_wait_reg_alloc(ANDROID_WAIT_SET *
+						AndroidWaitSet)
+{
+  ANDROID_WAIT_REG *reg ;
+
+  reg = AndroidWaitSet->spare ;
+  if (reg != OFC_NULL)
+    {
+      AndroidWaitSet->spare = reg->next ;
+      AndroidWaitSet->spare_count-- ;
+    }
+  else
+    reg = ofc_malloc (sizeof (ANDROID_WAIT_REG)) ;
+  return (reg) ;
+}
+
+/*
+ * Socket watch callbacks.  These keep the kernel's copy of a socket's
+ * interest mask current so the waiter never has to refetch it.
+ *
+ * They are handed the socket's copy of the watch, which may have been
+ * removed and its registration reused since.  The registration is
+ * looked up with the wait set locked and used only if it still holds
+ * the watch.
+ */
+static ANDROID_WAIT_SET *android_wait_socket_lock(OFC_SOCKET_WATCH *watch,
+						  ANDROID_WAIT_REG **reg)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  AndroidWaitSet = OFC_NULL ;
+  *reg = OFC_NULL ;
+  pWaitSet = ofc_handle_lock(watch->hOwner) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      if (AndroidWaitSet == OFC_NULL)
+	ofc_handle_unlock(watch->hOwner) ;
+      else
+	{
+	  ofc_lock (AndroidWaitSet->lock) ;
+	  *reg = android_wait_index_find(&AndroidWaitSet->handles,
+					 watch->hTarget) ;
+	  if (*reg != OFC_NULL && (*reg)->watch.serial != watch->serial)
+	    *reg = OFC_NULL ;
+	}
+    }
+  return (AndroidWaitSet) ;
+}
+
+static OFC_VOID android_wait_socket_unlock(OFC_SOCKET_WATCH *watch,
+					   ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  ofc_unlock (AndroidWaitSet->lock) ;
+  ofc_handle_unlock(watch->hOwner) ;
+}
+
+static OFC_VOID android_wait_socket_update(OFC_SOCKET_WATCH *watch)
+{
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  struct epoll_event event ;
+
+  AndroidWaitSet = android_wait_socket_lock(watch, &reg) ;
+  if (AndroidWaitSet == OFC_NULL)
+    return ;
+
+  if (reg != OFC_NULL)
+    {
+      reg->events = __atomic_load_n (watch->events, __ATOMIC_RELAXED) ;
+      /*
+       * A claimed descriptor picks up its new events when it's rearmed
+       */
+      if (reg->claimed)
+	;
+      else if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL && reg->fd != -1)
+	{
+	  /*
+	   * The poll and epoll event bits have the same values on Linux
+	   */
+	  event.events = reg->events ;
+	  if (AndroidWaitSet->group != OFC_NULL)
+	    event.events |= EPOLLONESHOT ;
+	  event.data.ptr = reg ;
+	  epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_MOD, reg->fd,
+		     &event) ;
+	}
+#if defined(OFC_WAITSET_URING)
+      else if (AndroidWaitSet->backend == ANDROID_WAIT_URING && reg->fd != -1)
+	{
+	  /*
+	   * An outstanding poll is cancelled and its completion rearms it
+	   * with the new events.  Otherwise the waiter is told to arm it.
+	   */
+	  if (reg->uring_pending)
+	    android_wait_uring_cancel(AndroidWaitSet, reg) ;
+	  else if (!reg->uring_queued)
+	    {
+	      android_wait_uring_queue(AndroidWaitSet, reg) ;
+	      android_wait_notify(AndroidWaitSet) ;
+	    }
+	}
+#endif
+    }
+  android_wait_socket_unlock(watch, AndroidWaitSet) ;
+}
+
+static OFC_VOID android_wait_socket_close(OFC_SOCKET_WATCH *watch)
+{
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  AndroidWaitSet = android_wait_socket_lock(watch, &reg) ;
+  if (AndroidWaitSet == OFC_NULL)
+    return ;
+
+  if (reg != OFC_NULL)
+    {
+      /*
+       * Unregister before the descriptor number can be reused
+       */
+      if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL && reg->fd != -1)
+	epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_DEL, reg->fd,
+		   OFC_NULL) ;
+#if defined(OFC_WAITSET_URING)
+      if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+	android_wait_uring_cancel(AndroidWaitSet, reg) ;
+#endif
+      reg->fd = -1 ;
+      reg->watch.revents = OFC_NULL ;
+      AndroidWaitSet->dirty = OFC_TRUE ;
+    }
+  android_wait_socket_unlock(watch, AndroidWaitSet) ;
+}
+
+OFC_VOID ofc_waitset_create_impl(WAIT_SET *pWaitSet)
+{
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+#if defined(OFC_WAITSET_EPOLL)
+  struct epoll_event event ;
+#endif
+  OFC_UINT32 i ;
+
+  AndroidWaitSet = ofc_malloc (sizeof (ANDROID_WAIT_SET)) ;
+  pWaitSet->impl = AndroidWaitSet ;
+
+  AndroidWaitSet->wake_files[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC) ;
+  if (AndroidWaitSet->wake_files[0] != -1)
+    {
+      AndroidWaitSet->wake_files[1] = AndroidWaitSet->wake_files[0] ;
+      AndroidWaitSet->wake_eventfd = OFC_TRUE ;
+    }
+  else
+    {
+      pipe (AndroidWaitSet->wake_files) ;
+      fcntl (AndroidWaitSet->wake_files[0], F_SETFL,
+	     fcntl (AndroidWaitSet->wake_files[0], F_GETFL) | O_NONBLOCK) ;
+      fcntl (AndroidWaitSet->wake_files[1], F_SETFL,
+	     fcntl (AndroidWaitSet->wake_files[1], F_GETFL) | O_NONBLOCK) ;
+      AndroidWaitSet->wake_eventfd = OFC_FALSE ;
+    }
+  for (i = 0 ; i < ANDROID_WAIT_PENDING ; i++)
+    AndroidWaitSet->pending[i] = OFC_HANDLE_NULL ;
+  AndroidWaitSet->pending_overflow = OFC_FALSE ;
+  AndroidWaitSet->pending_wake = OFC_FALSE ;
+  AndroidWaitSet->notified = OFC_FALSE ;
+  AndroidWaitSet->sleeping = OFC_FALSE ;
+  AndroidWaitSet->written = OFC_FALSE ;
+
+  AndroidWaitSet->lock = ofc_lock_init() ;
+  android_wait_index_init(&AndroidWaitSet->handles) ;
+  android_wait_index_init(&AndroidWaitSet->events) ;
+  AndroidWaitSet->fd_list.head = OFC_NULL ;
+  AndroidWaitSet->fd_list.tail = OFC_NULL ;
+  AndroidWaitSet->event_list.head = OFC_NULL ;
+  AndroidWaitSet->event_list.tail = OFC_NULL ;
+  AndroidWaitSet->fd_list.count = 0 ;
+  AndroidWaitSet->event_list.count = 0 ;
+  AndroidWaitSet->timer_list.head = OFC_NULL ;
+  AndroidWaitSet->timer_list.tail = OFC_NULL ;
+  AndroidWaitSet->timer_list.count = 0 ;
+  AndroidWaitSet->posted_list.head = OFC_NULL ;
+  AndroidWaitSet->posted_list.tail = OFC_NULL ;
+  AndroidWaitSet->posted_list.count = 0 ;
+  AndroidWaitSet->completed_head = OFC_NULL ;
+  AndroidWaitSet->completed_tail = OFC_NULL ;
+  AndroidWaitSet->timers = OFC_NULL ;
+  AndroidWaitSet->timer_count = 0 ;
+  AndroidWaitSet->timer_size = 0 ;
+  AndroidWaitSet->timers_stale = OFC_FALSE ;
+  AndroidWaitSet->timer_fd = -1 ;
+  AndroidWaitSet->timer_armed = 0 ;
+#if defined(OFC_WAITSET_TIMERFD)
+  AndroidWaitSet->timer_fd =
+    timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) ;
+#endif
+  AndroidWaitSet->cursor = OFC_NULL ;
+  AndroidWaitSet->pending_rotor = 0 ;
+  AndroidWaitSet->rotor = 0 ;
+  AndroidWaitSet->fd_starved = OFC_FALSE ;
+  AndroidWaitSet->zombies = OFC_NULL ;
+  AndroidWaitSet->spare = OFC_NULL ;
+  AndroidWaitSet->spare_count = 0 ;
+  AndroidWaitSet->serial = 0 ;
+  AndroidWaitSet->dirty = OFC_TRUE ;
+  AndroidWaitSet->poll_list = OFC_NULL ;
+  AndroidWaitSet->poll_regs = OFC_NULL ;
+  AndroidWaitSet->poll_count = 0 ;
+  AndroidWaitSet->poll_size = 0 ;
+
+  ofc_memset (&AndroidWaitSet->stats, '\0', sizeof (OFC_WAITSET_STATS)) ;
+  AndroidWaitSet->signal_stamp = 0 ;
+  AndroidWaitSet->signal_since = 0 ;
+  AndroidWaitSet->spin_max = 0 ;
+  AndroidWaitSet->spin_budget = 0 ;
+  AndroidWaitSet->hParent = OFC_HANDLE_NULL ;
+  AndroidWaitSet->hSelf = OFC_HANDLE_NULL ;
+  AndroidWaitSet->nested = OFC_NULL ;
+  AndroidWaitSet->prioritized = 0 ;
+  AndroidWaitSet->ranked = 0 ;
+  AndroidWaitSet->group = OFC_NULL ;
+  AndroidWaitSet->parked = OFC_FALSE ;
+  AndroidWaitSet->claims = OFC_NULL ;
+  AndroidWaitSet->stealable = 0 ;
+  for (i = 0 ; i < OFC_WAITSET_PRIORITIES ; i++)
+    {
+      AndroidWaitSet->classes[i].head = OFC_NULL ;
+      AndroidWaitSet->classes[i].tail = OFC_NULL ;
+      AndroidWaitSet->classes[i].skipped = 0 ;
+    }
+
+  AndroidWaitSet->backend = ANDROID_WAIT_POLL ;
+  AndroidWaitSet->epoll_fd = -1 ;
+#if defined(OFC_WAITSET_URING)
+  if (android_wait_uring_open(&AndroidWaitSet->uring))
+    AndroidWaitSet->backend = ANDROID_WAIT_URING ;
+#endif
+#if defined(OFC_WAITSET_EPOLL)
+  if (AndroidWaitSet->backend == ANDROID_WAIT_POLL)
+    AndroidWaitSet->epoll_fd = epoll_create1 (EPOLL_CLOEXEC) ;
+  if (AndroidWaitSet->epoll_fd != -1)
+    {
+      /*
+       * The wake channel and the timer descriptor are the only entries
+       * without a registration.  The timer descriptor is told apart by
+       * pointing at it.
+       */
+      event.events = EPOLLIN ;
+      event.data.ptr = OFC_NULL ;
+      if (epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_ADD,
+		     AndroidWaitSet->wake_files[0], &event) == 0)
+	AndroidWaitSet->backend = ANDROID_WAIT_EPOLL ;
+      else
+	{
+	  close (AndroidWaitSet->epoll_fd) ;
+	  AndroidWaitSet->epoll_fd = -1 ;
+	}
+
+      if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL &&
+	  AndroidWaitSet->timer_fd != -1)
+	{
+	  event.events = EPOLLIN ;
+	  event.data.ptr = &AndroidWaitSet->timer_fd ;
+	  if (epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_ADD,
+			 AndroidWaitSet->timer_fd, &event) != 0)
+	    {
+	      close (AndroidWaitSet->timer_fd) ;
+	      AndroidWaitSet->timer_fd = -1 ;
+	    }
+	}
+    }
+#endif
+}
+
+OFC_VOID ofc_waitset_destroy_impl(WAIT_SET *pWaitSet)
+{
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  AndroidWaitSet = pWaitSet->impl ;
+
+  if (AndroidWaitSet->group != OFC_NULL)
+    android_wait_group_leave(AndroidWaitSet) ;
+
+  /*
+   * Leave the wait set we're nested in before our descriptors go
+   */
+  if (AndroidWaitSet->hParent != OFC_HANDLE_NULL)
+    ofc_waitset_remove_impl(AndroidWaitSet->hParent, AndroidWaitSet->hSelf) ;
+
+  ofc_lock (AndroidWaitSet->lock) ;
+  while (AndroidWaitSet->fd_list.head != OFC_NULL)
+    android_wait_release(AndroidWaitSet, AndroidWaitSet->fd_list.head) ;
+  while (AndroidWaitSet->event_list.head != OFC_NULL)
+    android_wait_release(AndroidWaitSet, AndroidWaitSet->event_list.head) ;
+  while (AndroidWaitSet->posted_list.head != OFC_NULL)
+    android_wait_release(AndroidWaitSet, AndroidWaitSet->posted_list.head) ;
+  while (AndroidWaitSet->timer_list.head != OFC_NULL)
+    android_wait_release(AndroidWaitSet, AndroidWaitSet->timer_list.head) ;
+#if defined(OFC_WAITSET_URING)
+  /*
+   * Closing the ring drops every outstanding request
+   */
+  if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+    android_wait_uring_close(&AndroidWaitSet->uring) ;
+#endif
+  android_wait_reap(AndroidWaitSet, OFC_TRUE) ;
+  ofc_unlock (AndroidWaitSet->lock) ;
+
+  if (AndroidWaitSet->epoll_fd != -1)
+    close (AndroidWaitSet->epoll_fd) ;
+  if (AndroidWaitSet->timer_fd != -1)
+    close (AndroidWaitSet->timer_fd) ;
+  close (AndroidWaitSet->wake_files[0]) ;
+  if (!AndroidWaitSet->wake_eventfd)
+    close (AndroidWaitSet->wake_files[1]) ;
+
+  ofc_free (AndroidWaitSet->poll_list) ;
+  ofc_free (AndroidWaitSet->poll_regs) ;
+  ofc_free (AndroidWaitSet->timers) ;
+  ofc_free (AndroidWaitSet->handles.buckets) ;
+  ofc_free (AndroidWaitSet->events.buckets) ;
+  ofc_lock_destroy (AndroidWaitSet->lock) ;
+  ofc_free(pWaitSet->impl) ;
+  pWaitSet->impl = OFC_NULL;
+}
+
+/*
+ * Add an event handle to the pending set.  A handle that is already
+ * pending is not added again.
+ */
+static OFC_VOID android_wait_pending_add(ANDROID_WAIT_SET *AndroidWaitSet,
+					 OFC_HANDLE hEvent)
+{
+  OFC_HANDLE slot ;
+  OFC_UINT32 index ;
+  OFC_UINT32 probe ;
+  OFC_BOOL done ;
+
+  index = android_wait_hash(hEvent, ANDROID_WAIT_PENDING) ;
+  done = OFC_FALSE ;
+
+  for (probe = 0 ; probe < ANDROID_WAIT_PENDING_PROBE && !done ; probe++)
+    {
+      slot = __atomic_load_n (&AndroidWaitSet->pending[index],
+			      __ATOMIC_SEQ_CST) ;
+      if (slot == hEvent)
+	done = OFC_TRUE ;
+      else if (slot == OFC_HANDLE_NULL)
+	{
+	  if (__atomic_compare_exchange_n (&AndroidWaitSet->pending[index],
+					   &slot, hEvent, OFC_FALSE,
+					   __ATOMIC_SEQ_CST,
+					   __ATOMIC_SEQ_CST) ||
+	      slot == hEvent)
+	    done = OFC_TRUE ;
+	}
+      index = (index + 1) & (ANDROID_WAIT_PENDING - 1) ;
+    }
+
+  if (!done)
+    {
+      /*
+       * The set is crowded.  Have the waiter look at everything
+       */
+      __atomic_store_n (&AndroidWaitSet->pending_overflow, OFC_TRUE,
+			__ATOMIC_SEQ_CST) ;
+    }
+}
+
+static OFC_VOID android_wait_notify(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  OFC_UINT64 count ;
+  OFC_CHAR token ;
+
+  if (!__atomic_exchange_n (&AndroidWaitSet->notified, OFC_TRUE,
+			    __ATOMIC_SEQ_CST))
+    {
+      __atomic_store_n (&AndroidWaitSet->signal_stamp, android_wait_clock(),
+			__ATOMIC_SEQ_CST) ;
+      /*
+       * The parent of a nested wait set sleeps on our descriptors for
+       * us
+       */
+      if (__atomic_load_n (&AndroidWaitSet->sleeping, __ATOMIC_SEQ_CST) ||
+	  AndroidWaitSet->hParent != OFC_HANDLE_NULL)
+	{
+	  __atomic_store_n (&AndroidWaitSet->written, OFC_TRUE,
+			    __ATOMIC_SEQ_CST) ;
+	  if (AndroidWaitSet->wake_eventfd)
+	    {
+	      count = 1 ;
+	      write (AndroidWaitSet->wake_files[1], &count, sizeof (count)) ;
+	    }
+	  else
+	    {
+	      token = 0 ;
+	      write (AndroidWaitSet->wake_files[1], &token, sizeof (token)) ;
+	    }
+	}
+    }
+}
+
+/*
+ * Reset the wake channel so signals posted from here on write to it
+ * again.  Must be done before the pending set is drained.
+ */
+static OFC_VOID android_wait_consume(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  OFC_UINT64 count ;
+  OFC_CHAR tokens[64] ;
+  OFC_UINT64 stamp ;
+
+  stamp = __atomic_exchange_n (&AndroidWaitSet->signal_stamp, 0,
+			       __ATOMIC_SEQ_CST) ;
+  if (stamp != 0 && AndroidWaitSet->signal_since == 0)
+    AndroidWaitSet->signal_since = stamp ;
+
+  if (__atomic_exchange_n (&AndroidWaitSet->written, OFC_FALSE,
+			   __ATOMIC_SEQ_CST))
+    {
+      if (AndroidWaitSet->wake_eventfd)
+	read (AndroidWaitSet->wake_files[0], &count, sizeof (count)) ;
+      else
+	while (read (AndroidWaitSet->wake_files[0], tokens,
+		     sizeof (tokens)) > 0) ;
+    }
+
+  __atomic_store_n (&AndroidWaitSet->notified, OFC_FALSE, __ATOMIC_SEQ_CST) ;
+}
+
+OFC_VOID ofc_waitset_signal_impl(OFC_HANDLE handle, OFC_HANDLE hEvent)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  pWaitSet = ofc_handle_lock(handle) ;
+
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      if (hEvent == OFC_HANDLE_NULL)
+	__atomic_store_n (&AndroidWaitSet->pending_wake, OFC_TRUE,
+			  __ATOMIC_SEQ_CST) ;
+      else
+	android_wait_pending_add(AndroidWaitSet, hEvent) ;
+      android_wait_notify(AndroidWaitSet) ;
+      ofc_handle_unlock(handle) ;
+    }
+}
+
+OFC_VOID ofc_waitset_wake_impl(OFC_HANDLE handle)
+{
+  ofc_waitset_signal_impl(handle, OFC_HANDLE_NULL) ;
+}
+
+/*
+ * Test the event behind a registration, consuming it if it is an auto
+ * reset event.
+ */
+static OFC_BOOL android_wait_test_event(ANDROID_WAIT_REG *reg)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (ofc_event_test(reg->hEvent) == OFC_TRUE)
+    {
+      if (ofc_event_get_type(reg->hEvent) == OFC_EVENT_AUTO)
+	ofc_event_reset(reg->hEvent) ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Handles found ready by a wait.  Each wait bumps the wait set's serial
+ * and stamps registrations as they are reported so no handle is
+ * reported twice.
+ */
+typedef struct
+{
+  OFC_WAITSET_READY *ready ;
+  /*
+   * Registrations reported, when dispatching by priority
+   */
+  ANDROID_WAIT_REG **regs ;
+  OFC_INT count ;
+  OFC_INT num ;
+  OFC_UINT32 serial ;
+  /*
+   * For the statistics.  Handles examined and nanoseconds spent
+   * sleeping in the kernel.
+   */
+  OFC_UINT32 scanned ;
+  OFC_UINT64 blocked ;
+  OFC_BOOL spun ;
+  OFC_BOOL spin_hit ;
+} ANDROID_WAIT_RESULT ;
+
+static OFC_WAITSET_STATS_TYPE android_wait_stats_type(OFC_HANDLE_TYPE type)
+{
+  OFC_WAITSET_STATS_TYPE ret ;
+
+  switch (type)
+    {
+    case OFC_HANDLE_EVENT:
+      ret = OFC_WAITSET_STATS_EVENT ;
+      break ;
+    case OFC_HANDLE_WAIT_QUEUE:
+      ret = OFC_WAITSET_STATS_WAIT_QUEUE ;
+      break ;
+    case OFC_HANDLE_TIMER:
+      ret = OFC_WAITSET_STATS_TIMER ;
+      break ;
+    case OFC_HANDLE_SOCKET:
+      ret = OFC_WAITSET_STATS_SOCKET ;
+      break ;
+    case OFC_HANDLE_FILE:
+      ret = OFC_WAITSET_STATS_FILE ;
+      break ;
+    case OFC_HANDLE_FSRESOLVER_OVERLAPPED:
+    case OFC_HANDLE_FSANDROID_OVERLAPPED:
+    case OFC_HANDLE_FSSMB_OVERLAPPED:
+      ret = OFC_WAITSET_STATS_OVERLAPPED ;
+      break ;
+    default:
+      ret = OFC_WAITSET_STATS_OTHER ;
+      break ;
+    }
+  return (ret) ;
+}
+
+static OFC_VOID android_wait_stats_hist(OFC_UINT32 *hist, OFC_UINT64 value)
+{
+  OFC_INT bucket ;
+
+  for (bucket = 0 ; value != 0 && bucket < OFC_WAITSET_STATS_BUCKETS - 1 ;
+       bucket++)
+    value >>= 1 ;
+  hist[bucket]++ ;
+}
+
+static OFC_BOOL android_wait_result_full(ANDROID_WAIT_RESULT *result)
+{
+  return (result->num >= result->count) ;
+}
+
+static OFC_VOID android_wait_result_add(ANDROID_WAIT_RESULT *result,
+					ANDROID_WAIT_REG *reg,
+					OFC_UINT16 revents)
+{
+  if (!android_wait_result_full(result) && reg->serial != result->serial)
+    {
+      reg->serial = result->serial ;
+      reg->wait_set->stats.dispatched[android_wait_stats_type(reg->type)]++ ;
+      result->ready[result->num].hEvent = reg->hHandle ;
+      result->ready[result->num].revents = revents ;
+      if (result->regs != OFC_NULL)
+	result->regs[result->num] = reg ;
+      result->num++ ;
+    }
+}
+
+/*
+ * Report overlapped handles whose completions have been posted.  What
+ * doesn't fit stays queued for the next wait.  A completion gathered
+ * for dispatch by priority stays posted until it is handed out, so
+ * it isn't queued twice.
+ */
+static OFC_VOID android_wait_completions(ANDROID_WAIT_SET *AndroidWaitSet,
+					 ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+
+  while (AndroidWaitSet->completed_head != OFC_NULL &&
+	 !android_wait_result_full(result))
+    {
+      reg = AndroidWaitSet->completed_head ;
+      AndroidWaitSet->completed_head = reg->complete_next ;
+      if (AndroidWaitSet->completed_head == OFC_NULL)
+	AndroidWaitSet->completed_tail = OFC_NULL ;
+      if (result->regs == OFC_NULL || reg->removed)
+	reg->completed = OFC_FALSE ;
+      result->scanned++ ;
+      if (!reg->removed)
+	android_wait_result_add(result, reg, 0) ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Test a handle on the event list.
+ * A handle that has left the wait set is released.
+ */
+static OFC_BOOL android_wait_test(OFC_HANDLE handle,
+				  ANDROID_WAIT_SET *AndroidWaitSet,
+				  ANDROID_WAIT_REG *reg)
+{
+  OFC_BOOL triggered ;
+  OFC_HANDLE hWaitQ ;
+
+  triggered = OFC_FALSE ;
+  if (ofc_handle_get_wait_set(reg->hHandle) != handle)
+    android_wait_release(AndroidWaitSet, reg) ;
+  else
+    {
+      switch (reg->type)
+	{
+	default:
+	  break ;
+
+	case OFC_HANDLE_WAIT_QUEUE:
+	  if (!ofc_waitq_empty(reg->hHandle))
+	    triggered = OFC_TRUE ;
+	  break ;
+
+	case OFC_HANDLE_FSRESOLVER_OVERLAPPED:
+	case OFC_HANDLE_FSANDROID_OVERLAPPED:
+	  if (reg->hEvent != OFC_HANDLE_NULL && ofc_event_test(reg->hEvent))
+	    triggered = OFC_TRUE ;
+	  break ;
+
+	case OFC_HANDLE_FSSMB_OVERLAPPED:
+	  hWaitQ = OfcFileGetOverlappedWaitQ (reg->hHandle) ;
+	  if (!ofc_waitq_empty(hWaitQ))
+	    triggered = OFC_TRUE ;
+	  break ;
+
+	case OFC_HANDLE_EVENT:
+	  if (android_wait_test_event(reg))
+	    triggered = OFC_TRUE ;
+	  break ;
+	}
+    }
+  return (triggered) ;
+}
+
+/*
+ * Called with the wait set locked.  Report a handle found ready.  Only
+ * an auto reset event is cleared by testing it and anything else may
+ * still be ready without being signalled again, so it is left pending
+ * for the next wait to test.
+ */
+static OFC_VOID android_wait_report(ANDROID_WAIT_SET *AndroidWaitSet,
+				    ANDROID_WAIT_REG *reg,
+				    ANDROID_WAIT_RESULT *result)
+{
+  android_wait_result_add(result, reg, 0) ;
+  if (reg->hEvent != OFC_HANDLE_NULL &&
+      (reg->type != OFC_HANDLE_EVENT ||
+       ofc_event_get_type(reg->hEvent) != OFC_EVENT_AUTO))
+    android_wait_pending_add(AndroidWaitSet, reg->hEvent) ;
+}
+
+/*
+ * Called with the wait set locked.  Report the handles signalled since
+ * the last drain and the completions that have been posted.  Signals
+ * that don't fit stay pending for the next wait.  The whole event list
+ * is tested only when signals were lost to a crowded pending set.
+ */
+static OFC_VOID android_wait_drain(OFC_HANDLE handle,
+				   ANDROID_WAIT_SET *AndroidWaitSet,
+				   ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *next ;
+  OFC_HANDLE hEvent ;
+  OFC_UINT32 index ;
+  OFC_UINT32 visit ;
+
+  android_wait_consume(AndroidWaitSet) ;
+  if (__atomic_exchange_n (&AndroidWaitSet->pending_wake, OFC_FALSE,
+			   __ATOMIC_SEQ_CST))
+    AndroidWaitSet->timers_stale = OFC_TRUE ;
+
+  /*
+   * Start past the last slot reported so later slots can't be starved
+   */
+  index = AndroidWaitSet->pending_rotor ;
+  for (visit = ANDROID_WAIT_PENDING ;
+       visit > 0 && !android_wait_result_full(result) ;
+       visit--, index = (index + 1) & (ANDROID_WAIT_PENDING - 1))
+    {
+      /*
+       * Only we empty slots, so the slot can't change under us once it
+       * is seen to be in use.  A handle this wait has already reported
+       * stays pending for the next one.
+       */
+      hEvent = __atomic_load_n (&AndroidWaitSet->pending[index],
+				__ATOMIC_SEQ_CST) ;
+      if (hEvent == OFC_HANDLE_NULL)
+	continue ;
+      reg = android_wait_index_find(&AndroidWaitSet->events, hEvent) ;
+      if (reg != OFC_NULL && reg->serial == result->serial)
+	continue ;
+
+      __atomic_store_n (&AndroidWaitSet->pending[index], OFC_HANDLE_NULL,
+			__ATOMIC_SEQ_CST) ;
+      result->scanned++ ;
+      /*
+       * Overlapped handles whose completions are posted are reported
+       * from the completion queue
+       */
+      if (reg != OFC_NULL && reg->list == &AndroidWaitSet->event_list &&
+	  android_wait_test(handle, AndroidWaitSet, reg))
+	android_wait_report(AndroidWaitSet, reg, result) ;
+    }
+  AndroidWaitSet->pending_rotor = index ;
+
+  android_wait_completions(AndroidWaitSet, result) ;
+
+  if (__atomic_exchange_n (&AndroidWaitSet->pending_overflow, OFC_FALSE,
+			   __ATOMIC_SEQ_CST))
+    {
+      /*
+       * Some signals didn't fit in the pending set.  Test everything
+       * on the event list, starting past the last handle reported so
+       * early registrations can't starve later ones.  If the result
+       * fills first, the next wait tests everything again.
+       */
+      reg = AndroidWaitSet->cursor ;
+      if (reg == OFC_NULL)
+	reg = AndroidWaitSet->event_list.head ;
+      for (visit = AndroidWaitSet->event_list.count ;
+	   visit > 0 && reg != OFC_NULL && !android_wait_result_full(result) ;
+	   visit--, reg = next)
+	{
+	  result->scanned++ ;
+	  next = reg->next ;
+	  if (next == OFC_NULL)
+	    next = AndroidWaitSet->event_list.head ;
+	  if (next == reg)
+	    next = OFC_NULL ;
+
+	  if (reg->serial != result->serial &&
+	      android_wait_test(handle, AndroidWaitSet, reg))
+	    {
+	      android_wait_report(AndroidWaitSet, reg, result) ;
+	      AndroidWaitSet->cursor = next ;
+	    }
+	}
+      if (visit > 0 && reg != OFC_NULL)
+	__atomic_store_n (&AndroidWaitSet->pending_overflow, OFC_TRUE,
+			  __ATOMIC_SEQ_CST) ;
+    }
+}
+
+/*
+ * Called with the wait set locked when the wake channel is readable
+ */
+OFC_VOID PollEvent (OFC_HANDLE handle, ANDROID_WAIT_SET *AndroidWaitSet,
+		    ANDROID_WAIT_RESULT *result)
+{
+  OFC_INT num ;
+
+  num = result->num ;
+  android_wait_drain(handle, AndroidWaitSet, result) ;
+  if (result->num == num)
+    AndroidWaitSet->stats.spurious++ ;
+}
+
+/*
+ * Report the expired timers in the subtree rooted at index.  Expired
+ * timers stay expired until they are set again, so they remain in the
+ * heap and are found at its top.
+ */
+static OFC_VOID android_wait_timer_collect(OFC_HANDLE handle,
+					   ANDROID_WAIT_SET *AndroidWaitSet,
+					   OFC_INT index, OFC_UINT64 now,
+					   ANDROID_WAIT_RESULT *result,
+					   OFC_BOOL *stale)
+{
+  ANDROID_WAIT_REG *reg ;
+
+  if (index < AndroidWaitSet->timer_count &&
+      !android_wait_result_full(result))
+    {
+      reg = AndroidWaitSet->timers[index] ;
+      result->scanned++ ;
+      if (!android_wait_before(now, reg->deadline))
+	{
+	  if (ofc_handle_get_wait_set(reg->hHandle) != handle)
+	    *stale = OFC_TRUE ;
+	  else
+	    android_wait_result_add(result, reg, 0) ;
+	  android_wait_timer_collect(handle, AndroidWaitSet, index * 2 + 1,
+				     now, result, stale) ;
+	  android_wait_timer_collect(handle, AndroidWaitSet, index * 2 + 2,
+				     now, result, stale) ;
+	}
+    }
+}
+
+/*
+ * Called with the wait set locked.  A nested wait set without a timer
+ * descriptor among those we watch can't tell us when its timers
+ * expire.  Report those whose earliest timer has expired and return
+ * how long until the next one does.
+ */
+static int android_wait_nested_timers(ANDROID_WAIT_SET *AndroidWaitSet,
+				      OFC_UINT64 now, int leastWait,
+				      ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+  WAIT_SET *pChild ;
+  ANDROID_WAIT_SET *child ;
+  OFC_UINT64 deadline ;
+
+  for (reg = AndroidWaitSet->nested ; reg != OFC_NULL ; reg = reg->nest_next)
+    {
+      pChild = ofc_handle_lock(reg->hHandle) ;
+      if (pChild != OFC_NULL)
+	{
+	  child = pChild->impl ;
+	  if (child != OFC_NULL)
+	    {
+	      ofc_lock (child->lock) ;
+	      if ((child->backend == ANDROID_WAIT_POLL ||
+		   child->timer_fd == -1) && child->timer_count > 0)
+		{
+		  deadline = child->timers[0]->deadline ;
+		  if (!android_wait_before(now, deadline))
+		    android_wait_result_add(result, reg, POLLIN) ;
+		  else if ((deadline - now + 999999) / 1000000 <
+			   (OFC_UINT64) leastWait)
+		    leastWait = (deadline - now + 999999) / 1000000 ;
+		}
+	      ofc_unlock (child->lock) ;
+	    }
+	  ofc_handle_unlock(reg->hHandle) ;
+	}
+    }
+  return (leastWait) ;
+}
+
+/*
+ * Called with the wait set locked.  Report expired timers and return
+ * how long until the next one expires.
+ */
+static int android_wait_timers(OFC_HANDLE handle,
+			       ANDROID_WAIT_SET *AndroidWaitSet,
+			       ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+  OFC_UINT64 now ;
+  OFC_UINT64 next ;
+  OFC_BOOL stale ;
+  OFC_INT index ;
+  int leastWait ;
+  struct itimerspec spec ;
+
+  if (AndroidWaitSet->timers_stale)
+    android_wait_timer_refresh(AndroidWaitSet) ;
+
+  now = android_wait_clock() ;
+  stale = OFC_FALSE ;
+  android_wait_timer_collect(handle, AndroidWaitSet, 0, now, result,
+			     &stale) ;
+  if (stale)
+    {
+      /*
+       * Some timers left the wait set without telling us
+       */
+      for (index = AndroidWaitSet->timer_count - 1 ; index >= 0 ; index--)
+	{
+	  if (index < AndroidWaitSet->timer_count)
+	    {
+	      reg = AndroidWaitSet->timers[index] ;
+	      if (ofc_handle_get_wait_set(reg->hHandle) != handle)
+		android_wait_release(AndroidWaitSet, reg) ;
+	    }
+	}
+    }
+
+  leastWait = OFC_MAX_SCHED_WAIT ;
+  next = 0 ;
+  if (AndroidWaitSet->timer_count > 0)
+    {
+      reg = AndroidWaitSet->timers[0] ;
+      if (!android_wait_before(now, reg->deadline))
+	leastWait = 0 ;
+      else
+	{
+	  next = reg->deadline ;
+	  if (AndroidWaitSet->timer_fd == -1 &&
+	      (reg->deadline - now + 999999) / 1000000 <
+	      (OFC_UINT64) leastWait)
+	    leastWait = (reg->deadline - now + 999999) / 1000000 ;
+	}
+    }
+
+  if (AndroidWaitSet->timer_fd != -1 && next != AndroidWaitSet->timer_armed)
+    {
+      /*
+       * Arm for the earliest deadline.  A zero deadline disarms.
+       */
+      spec.it_interval.tv_sec = 0 ;
+      spec.it_interval.tv_nsec = 0 ;
+      spec.it_value.tv_sec = next / 1000000000 ;
+      spec.it_value.tv_nsec = next % 1000000000 ;
+      timerfd_settime (AndroidWaitSet->timer_fd, TFD_TIMER_ABSTIME,
+		       &spec, OFC_NULL) ;
+      AndroidWaitSet->timer_armed = next ;
+    }
+
+  if (AndroidWaitSet->nested != OFC_NULL)
+    leastWait = android_wait_nested_timers(AndroidWaitSet, now, leastWait,
+					   result) ;
+
+  return (leastWait) ;
+}
+
+/*
+ * Called with the wait set locked after the backend timed out.  The
+ * earliest timer is reported even if the clock hasn't quite reached it.
+ */
+static OFC_VOID android_wait_timeout(OFC_HANDLE handle,
+				     ANDROID_WAIT_SET *AndroidWaitSet,
+				     ANDROID_WAIT_RESULT *result)
+{
+  android_wait_timers(handle, AndroidWaitSet, result) ;
+  if (result->num == 0 && AndroidWaitSet->timer_count > 0)
+    android_wait_result_add(result, AndroidWaitSet->timers[0], 0) ;
+}
+
+/*
+ * Called with the wait set locked when the timer descriptor fires
+ */
+static OFC_VOID android_wait_timer_fire(OFC_HANDLE handle,
+					ANDROID_WAIT_SET *AndroidWaitSet,
+					ANDROID_WAIT_RESULT *result)
+{
+  OFC_UINT64 expirations ;
+
+  read (AndroidWaitSet->timer_fd, &expirations, sizeof (expirations)) ;
+  AndroidWaitSet->timer_armed = 0 ;
+  android_wait_timers(handle, AndroidWaitSet, result) ;
+}
+
+#if defined(OF_RESOLVER_FS)
+typedef OFC_HANDLE (*getEventHandleFunc)(OFC_HANDLE parentHandle);
+
+/*
+ * Resolver requires JNI.  It is a reverse JNI module
+ * that lets us call back into the Java App.
+ * The problem is, we build the android waitset into
+ * the core.  It is not linked with the JNI layer.
+ * So, even though we would hope we can do dynamic linking
+ * the build will fail if we call the resolver here.  So,
+ * let's see if we can do our own dynamic binding
+ */
+static OFC_HANDLE
+ofc_android_get_resolver_overlapped_event(OFC_HANDLE hEventHandle)
+{
+  OFC_HANDLE hEvent;
+  
+  static getEventHandleFunc overlapped_function = OFC_NULL;
+
+  if (overlapped_function == OFC_NULL)
+    {
+      /*
+       * Bind to the function
+       */
+      overlapped_function =
+        (getEventHandleFunc) dlsym(RTLD_DEFAULT,
+                                   "OfcFSResolverGetOverlappedEvent");
+      if (overlapped_function == OFC_NULL)
+        {
+          ofc_process_crash(dlerror());
+        }
+    }
+
+  hEvent = overlapped_function(hEventHandle);
+  return (hEvent);
+}
+#endif
+
+/*
+ * Called with the wait set locked.  Rebuild the poll list if the
+ * registrations have changed and refresh each descriptor's interest
+ * from its registration.
+ */
+static OFC_VOID android_wait_poll_prepare(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  ANDROID_WAIT_REG *reg ;
+  nfds_t count ;
+  nfds_t wait_index ;
+
+  if (AndroidWaitSet->dirty)
+    {
+      count = 2 ;
+      for (reg = AndroidWaitSet->fd_list.head ; reg != OFC_NULL ;
+	   reg = reg->next)
+	count++ ;
+
+      if (count > AndroidWaitSet->poll_size)
+	{
+	  if (count < AndroidWaitSet->poll_size * 2)
+	    count = AndroidWaitSet->poll_size * 2 ;
+	  AndroidWaitSet->poll_list =
+	    ofc_realloc (AndroidWaitSet->poll_list,
+			 sizeof (struct pollfd) * count) ;
+	  AndroidWaitSet->poll_regs =
+	    ofc_realloc (AndroidWaitSet->poll_regs,
+			 sizeof (ANDROID_WAIT_REG *) * count) ;
+	  AndroidWaitSet->poll_size = count ;
+	}
+
+      AndroidWaitSet->poll_list[0].fd = AndroidWaitSet->wake_files[0] ;
+      AndroidWaitSet->poll_list[0].events = POLLIN ;
+      AndroidWaitSet->poll_regs[0] = OFC_NULL ;
+
+      count = 1 ;
+      if (AndroidWaitSet->timer_fd != -1)
+	{
+	  AndroidWaitSet->poll_list[count].fd = AndroidWaitSet->timer_fd ;
+	  AndroidWaitSet->poll_list[count].events = POLLIN ;
+	  AndroidWaitSet->poll_regs[count++] = OFC_NULL ;
+	}
+      for (reg = AndroidWaitSet->fd_list.head ; reg != OFC_NULL ;
+	   reg = reg->next)
+	AndroidWaitSet->poll_regs[count++] = reg ;
+
+      AndroidWaitSet->poll_count = count ;
+      AndroidWaitSet->dirty = OFC_FALSE ;
+    }
+
+  for (wait_index = 0 ; wait_index < AndroidWaitSet->poll_count ;
+       wait_index++)
+    {
+      reg = AndroidWaitSet->poll_regs[wait_index] ;
+      if (reg != OFC_NULL)
+	{
+	  /*
+	   * Poll ignores negative descriptors
+	   */
+	  AndroidWaitSet->poll_list[wait_index].fd =
+	    reg->claimed ? -1 : reg->fd ;
+	  AndroidWaitSet->poll_list[wait_index].events = reg->events ;
+	}
+      AndroidWaitSet->poll_list[wait_index].revents = 0 ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Report a ready descriptor unless
+ * its registration is stale.
+ */
+static OFC_VOID android_wait_ready(OFC_HANDLE handle,
+				   ANDROID_WAIT_SET *AndroidWaitSet,
+				   ANDROID_WAIT_REG *reg,
+				   OFC_UINT16 revents,
+				   ANDROID_WAIT_RESULT *result)
+{
+  OFC_INT num ;
+
+  result->scanned++ ;
+  if (!reg->removed && !android_wait_result_full(result))
+    {
+      if (ofc_handle_get_wait_set(reg->hHandle) != handle)
+	{
+	  /*
+	   * The handle left the wait set without telling us
+	   */
+	  android_wait_release(AndroidWaitSet, reg) ;
+	}
+      else
+	{
+	  if (reg->watch.revents != OFC_NULL)
+	    __atomic_store_n (reg->watch.revents, revents, __ATOMIC_RELAXED) ;
+	  num = result->num ;
+	  android_wait_result_add(result, reg, revents) ;
+	  if (AndroidWaitSet->group != OFC_NULL && result->num > num)
+	    reg->claimed = OFC_TRUE ;
+	}
+    }
+  else if (!reg->removed && AndroidWaitSet->group != OFC_NULL)
+    {
+      /*
+       * No room.  The descriptor won't be reported again unless it's
+       * watched again.
+       */
+      android_wait_rearm(AndroidWaitSet, reg, AndroidWaitSet) ;
+    }
+}
+
+static OFC_VOID android_wait_poll(OFC_HANDLE handle,
+				  ANDROID_WAIT_SET *AndroidWaitSet,
+				  int leastWait,
+				  OFC_BOOL timed,
+				  ANDROID_WAIT_RESULT *result)
+{
+  int poll_count ;
+  nfds_t wait_index ;
+  nfds_t scan ;
+
+  poll_count = poll (AndroidWaitSet->poll_list, AndroidWaitSet->poll_count,
+		     leastWait) ;
+  if (poll_count == 0 && timed)
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      android_wait_timeout(handle, AndroidWaitSet, result) ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+  else if (poll_count > 0)
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      /*
+       * Start the scan where the last one left off
+       */
+      wait_index = AndroidWaitSet->rotor % AndroidWaitSet->poll_count ;
+      for (scan = 0 ;
+	   (scan < AndroidWaitSet->poll_count &&
+	    !android_wait_result_full(result)) ;
+	   scan++)
+	{
+	  if (AndroidWaitSet->poll_list[wait_index].revents != 0)
+	    {
+	      if (wait_index == 0)
+		PollEvent(handle, AndroidWaitSet, result) ;
+	      else if (AndroidWaitSet->poll_regs[wait_index] == OFC_NULL)
+		android_wait_timer_fire(handle, AndroidWaitSet, result) ;
+	      else
+		android_wait_ready(handle, AndroidWaitSet,
+				   AndroidWaitSet->poll_regs[wait_index],
+				   AndroidWaitSet->poll_list[wait_index].revents,
+				   result) ;
+	      AndroidWaitSet->rotor = wait_index + 1 ;
+	    }
+	  wait_index++ ;
+	  if (wait_index == AndroidWaitSet->poll_count)
+	    wait_index = 0 ;
+	}
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+}
+
+static OFC_VOID android_wait_epoll(OFC_HANDLE handle,
+				   ANDROID_WAIT_SET *AndroidWaitSet,
+				   int leastWait,
+				   OFC_BOOL timed,
+				   ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+  int epoll_count ;
+  int wait_index ;
+  int max_events ;
+
+  /*
+   * Only ask for what we have room for.  The kernel requeues level
+   * triggered descriptors behind the others once reported, so
+   * anything we don't take now is reported ahead of them next time.
+   */
+  max_events = result->count - result->num ;
+  if (max_events > ANDROID_WAIT_EPOLL_EVENTS)
+    max_events = ANDROID_WAIT_EPOLL_EVENTS ;
+
+  epoll_count = epoll_wait (AndroidWaitSet->epoll_fd,
+			    AndroidWaitSet->epoll_events,
+			    max_events, leastWait) ;
+  if (epoll_count == 0 && timed)
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      android_wait_timeout(handle, AndroidWaitSet, result) ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+  else if (epoll_count > 0)
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      /*
+       * Everything returned is looked at, even once the result is
+       * full, so one shot descriptors that don't fit are rearmed
+       */
+      for (wait_index = 0 ; wait_index < epoll_count ; wait_index++)
+	{
+	  reg = AndroidWaitSet->epoll_events[wait_index].data.ptr ;
+	  if (reg == OFC_NULL)
+	    PollEvent(handle, AndroidWaitSet, result) ;
+	  else if ((OFC_VOID *) reg == &AndroidWaitSet->timer_fd)
+	    android_wait_timer_fire(handle, AndroidWaitSet, result) ;
+	  else
+	    android_wait_ready(handle, AndroidWaitSet, reg,
+			       AndroidWaitSet->epoll_events[wait_index].events,
+			       result) ;
+	}
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+}
+
+#if defined(OFC_WAITSET_URING)
+/*
+ * Called with the wait set locked.  Put poll requests on the ring for
+ * everything that needs one.
+ */
+static OFC_VOID android_wait_uring_arm(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  ANDROID_WAIT_RING *uring ;
+  ANDROID_WAIT_REG *reg ;
+
+  uring = &AndroidWaitSet->uring ;
+  if (!uring->wake_armed)
+    uring->wake_armed =
+      android_wait_uring_poll(uring, ANDROID_WAIT_URING_WAKE,
+			      AndroidWaitSet->wake_files[0], POLLIN) ;
+  if (AndroidWaitSet->timer_fd != -1 && !uring->timer_armed)
+    uring->timer_armed =
+      android_wait_uring_poll(uring, ANDROID_WAIT_URING_TIMER,
+			      AndroidWaitSet->timer_fd, POLLIN) ;
+
+  while (uring->arm != OFC_NULL)
+    {
+      reg = uring->arm ;
+      if (!reg->removed && reg->fd != -1)
+	{
+	  /*
+	   * If the ring is full, leave the rest for the next wait
+	   */
+	  if (!android_wait_uring_poll(uring, (OFC_UINT64) (OFC_DWORD_PTR) reg,
+				       reg->fd, reg->events))
+	    break ;
+	  reg->uring_pending = OFC_TRUE ;
+	}
+      uring->arm = reg->arm_next ;
+      if (uring->arm == OFC_NULL)
+	uring->arm_tail = OFC_NULL ;
+      reg->uring_queued = OFC_FALSE ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Arm everything and decide how the
+ * waiter will enter the kernel.  The submissions go in with the wait
+ * itself.
+ */
+static OFC_VOID android_wait_uring_prepare(ANDROID_WAIT_SET *AndroidWaitSet,
+					   int leastWait,
+					   ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_RING *uring ;
+  struct io_uring_sqe *sqe ;
+
+  uring = &AndroidWaitSet->uring ;
+  android_wait_uring_arm(AndroidWaitSet) ;
+
+  uring->block = (leastWait != 0) ;
+  if (uring->block)
+    {
+      sqe = android_wait_uring_sqe(uring) ;
+      if (sqe != OFC_NULL)
+	{
+	  /*
+	   * Expires after leastWait or completes with the first other
+	   * completion
+	   */
+	  uring->timeout.tv_sec = leastWait / 1000 ;
+	  uring->timeout.tv_nsec = (leastWait % 1000) * 1000000 ;
+	  sqe->opcode = IORING_OP_TIMEOUT ;
+	  sqe->addr = (OFC_UINT64) (OFC_DWORD_PTR) &uring->timeout ;
+	  sqe->len = 1 ;
+	  sqe->off = 1 ;
+	  sqe->user_data = ((OFC_UINT64) result->serial << 3) |
+	    ANDROID_WAIT_URING_TIMEOUT ;
+	  android_wait_uring_commit(uring) ;
+	}
+    }
+
+  uring->submit = uring->queued ;
+  uring->queued = 0 ;
+}
+
+/*
+ * Called with the wait set locked.  Consume completions until the
+ * result is full.  Those left over are picked up, in order, by the
+ * next wait.  Poll requests are one shot so each completion queues its
+ * registration to be armed again.
+ */
+static OFC_VOID android_wait_uring_complete(OFC_HANDLE handle,
+					    ANDROID_WAIT_SET *AndroidWaitSet,
+					    OFC_BOOL timed,
+					    ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_RING *uring ;
+  ANDROID_WAIT_REG *reg ;
+  struct io_uring_cqe *cqe ;
+  OFC_UINT32 head ;
+  OFC_UINT32 tail ;
+
+  uring = &AndroidWaitSet->uring ;
+  head = *uring->cq_head ;
+  tail = __atomic_load_n (uring->cq_tail, __ATOMIC_ACQUIRE) ;
+  for ( ; head != tail && !android_wait_result_full(result) ; head++)
+    {
+      cqe = &uring->cqes[head & uring->cq_mask] ;
+      switch (cqe->user_data & ANDROID_WAIT_URING_TAG)
+	{
+	case ANDROID_WAIT_URING_WAKE:
+	  uring->wake_armed = OFC_FALSE ;
+	  PollEvent(handle, AndroidWaitSet, result) ;
+	  break ;
+
+	case ANDROID_WAIT_URING_TIMER:
+	  uring->timer_armed = OFC_FALSE ;
+	  android_wait_timer_fire(handle, AndroidWaitSet, result) ;
+	  break ;
+
+	case ANDROID_WAIT_URING_TIMEOUT:
+	  /*
+	   * A timeout left over from an earlier wait means nothing
+	   */
+	  if (cqe->res == -ETIME && timed &&
+	      (OFC_UINT32) (cqe->user_data >> 3) == result->serial)
+	    android_wait_timeout(handle, AndroidWaitSet, result) ;
+	  break ;
+
+	case ANDROID_WAIT_URING_CANCEL:
+	  break ;
+
+	default:
+	  reg = (ANDROID_WAIT_REG *) (OFC_DWORD_PTR) cqe->user_data ;
+	  reg->uring_pending = OFC_FALSE ;
+	  /*
+	   * Descriptors that can't be polled, like regular files, fail
+	   * and are not rearmed.  They never become ready.
+	   */
+	  if (!reg->removed && (cqe->res >= 0 || cqe->res == -ECANCELED))
+	    {
+	      if (cqe->res > 0)
+		android_wait_ready(handle, AndroidWaitSet, reg, cqe->res,
+				   result) ;
+	      /*
+	       * Claimed descriptors are armed again when released
+	       */
+	      if (!reg->removed && !reg->claimed && !reg->uring_queued)
+		android_wait_uring_queue(AndroidWaitSet, reg) ;
+	    }
+	  break ;
+	}
+    }
+  __atomic_store_n (uring->cq_head, head, __ATOMIC_RELEASE) ;
+}
+
+static OFC_VOID android_wait_uring(OFC_HANDLE handle,
+				   ANDROID_WAIT_SET *AndroidWaitSet,
+				   OFC_BOOL timed,
+				   ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_RING *uring ;
+
+  uring = &AndroidWaitSet->uring ;
+  android_wait_uring_enter(uring, uring->submit, uring->block ? 1 : 0) ;
+
+  ofc_lock (AndroidWaitSet->lock) ;
+  android_wait_uring_complete(handle, AndroidWaitSet, timed, result) ;
+  ofc_unlock (AndroidWaitSet->lock) ;
+}
+
+/*
+ * Called with the wait set locked.  A wait set using io_uring only
+ * hands its requests to the kernel while it is waited on.  Submit
+ * those of the wait sets nested in us before we sleep so their rings
+ * report whatever becomes ready.
+ */
+static OFC_VOID android_wait_uring_nested(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  ANDROID_WAIT_REG *reg ;
+  WAIT_SET *pChild ;
+  ANDROID_WAIT_SET *child ;
+
+  for (reg = AndroidWaitSet->nested ; reg != OFC_NULL ; reg = reg->nest_next)
+    {
+      pChild = ofc_handle_lock(reg->hHandle) ;
+      if (pChild != OFC_NULL)
+	{
+	  child = pChild->impl ;
+	  if (child != OFC_NULL && child->backend == ANDROID_WAIT_URING)
+	    {
+	      ofc_lock (child->lock) ;
+	      android_wait_uring_arm(child) ;
+	      if (child->uring.queued != 0)
+		{
+		  android_wait_uring_enter(&child->uring, child->uring.queued,
+					   0) ;
+		  child->uring.queued = 0 ;
+		}
+	      ofc_unlock (child->lock) ;
+	    }
+	  ofc_handle_unlock(reg->hHandle) ;
+	}
+    }
+}
+#endif
+
+/*
+ * Busy poll for up to the current window before the waiter sleeps.
+ * Signals are seen as soon as the wake channel is marked, without a
+ * system call.  Returns whether anything turned up.
+ */
+static OFC_BOOL android_wait_spin(OFC_HANDLE handle,
+				  ANDROID_WAIT_SET *AndroidWaitSet,
+				  int leastWait,
+				  ANDROID_WAIT_RESULT *result)
+{
+  OFC_UINT64 budget ;
+  OFC_UINT64 deadline ;
+  OFC_BOOL hit ;
+#if defined(OFC_WAITSET_URING)
+  ANDROID_WAIT_RING *uring ;
+#endif
+
+  hit = OFC_FALSE ;
+  budget = AndroidWaitSet->spin_budget ;
+  if (leastWait > 0 && budget > (OFC_UINT64) leastWait * 1000000)
+    budget = (OFC_UINT64) leastWait * 1000000 ;
+
+  if (budget != 0)
+    {
+      result->spun = OFC_TRUE ;
+#if defined(OFC_WAITSET_URING)
+      uring = &AndroidWaitSet->uring ;
+      if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+	{
+	  /*
+	   * Get the poll requests in, then watch the completion ring
+	   */
+	  android_wait_uring_enter(uring, uring->submit, 0) ;
+	  uring->submit = 0 ;
+	}
+#endif
+      deadline = android_wait_clock() + budget ;
+      do
+	{
+	  if (__atomic_load_n (&AndroidWaitSet->notified, __ATOMIC_SEQ_CST))
+	    hit = OFC_TRUE ;
+#if defined(OFC_WAITSET_URING)
+	  else if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+	    hit = (*uring->cq_head !=
+		   __atomic_load_n (uring->cq_tail, __ATOMIC_ACQUIRE)) ;
+#endif
+	  else if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL)
+	    {
+	      android_wait_epoll(handle, AndroidWaitSet, 0, OFC_FALSE, result) ;
+	      hit = (result->num > 0) ;
+	    }
+	  else
+	    {
+	      android_wait_poll(handle, AndroidWaitSet, 0, OFC_FALSE, result) ;
+	      hit = (result->num > 0) ;
+	    }
+	}
+      while (!hit && android_wait_clock() < deadline) ;
+      result->spin_hit = hit ;
+    }
+  return (hit) ;
+}
+
+/*
+ * Adjust the busy poll window.  It grows when polling found something
+ * or would have, because the sleep that followed was shorter than the
+ * longest window.  It shrinks when the sleep was longer.
+ */
+static OFC_VOID android_wait_spin_adapt(ANDROID_WAIT_SET *AndroidWaitSet,
+					ANDROID_WAIT_RESULT *result)
+{
+  OFC_UINT64 budget ;
+
+  budget = AndroidWaitSet->spin_budget ;
+  if (result->spin_hit ||
+      (result->num > 0 && result->blocked <= AndroidWaitSet->spin_max))
+    {
+      budget = budget * 2 ;
+      if (budget < ANDROID_WAIT_SPIN_MIN)
+	budget = ANDROID_WAIT_SPIN_MIN ;
+      if (budget > AndroidWaitSet->spin_max)
+	budget = AndroidWaitSet->spin_max ;
+    }
+  else if (result->blocked > AndroidWaitSet->spin_max)
+    {
+      budget = budget / 2 ;
+      if (budget < ANDROID_WAIT_SPIN_MIN)
+	budget = 0 ;
+    }
+  AndroidWaitSet->spin_budget = budget ;
+}
+
+/*
+ * Called with the wait set locked.  Returns with it unlocked.
+ */
+static OFC_VOID android_wait_descriptors(OFC_HANDLE handle,
+					 ANDROID_WAIT_SET *AndroidWaitSet,
+					 int leastWait,
+					 OFC_BOOL timed,
+					 ANDROID_WAIT_RESULT *result)
+{
+  OFC_UINT64 start ;
+#if defined(OFC_WAITSET_URING)
+  OFC_INT ready ;
+
+  if (leastWait != 0)
+    android_wait_uring_nested(AndroidWaitSet) ;
+#endif
+
+  if (AndroidWaitSet->backend == ANDROID_WAIT_POLL)
+    android_wait_poll_prepare(AndroidWaitSet) ;
+#if defined(OFC_WAITSET_URING)
+  else if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+    {
+      /*
+       * Completions left from an earlier wait come first.  If they
+       * report anything, return them without arming anything.  Those
+       * just reported are rearmed by the next wait, once the caller
+       * has dealt with them.
+       */
+      ready = result->num ;
+      android_wait_uring_complete(handle, AndroidWaitSet, OFC_FALSE,
+				  result) ;
+      if (result->num > ready)
+	{
+	  ofc_unlock (AndroidWaitSet->lock) ;
+	  return ;
+	}
+      android_wait_uring_prepare(AndroidWaitSet, leastWait, result) ;
+    }
+#endif
+
+  ofc_unlock (AndroidWaitSet->lock) ;
+
+  if (leastWait != 0 && AndroidWaitSet->spin_max != 0)
+    {
+      if (android_wait_spin(handle, AndroidWaitSet, leastWait, result))
+	{
+	  android_wait_spin_adapt(AndroidWaitSet, result) ;
+	  /*
+	   * Collect whatever turned up without sleeping
+	   */
+	  if (result->num > 0)
+	    return ;
+	  leastWait = 0 ;
+	  timed = OFC_FALSE ;
+	}
+    }
+
+  if (leastWait != 0)
+    {
+      /*
+       * Signallers write the wake channel from here on.  If something
+       * was signalled before they could see that, don't sleep.
+       */
+      __atomic_store_n (&AndroidWaitSet->sleeping, OFC_TRUE,
+			__ATOMIC_SEQ_CST) ;
+      if (__atomic_load_n (&AndroidWaitSet->notified, __ATOMIC_SEQ_CST))
+	{
+	  leastWait = 0 ;
+	  timed = OFC_FALSE ;
+	}
+    }
+#if defined(OFC_WAITSET_URING)
+  if (leastWait == 0)
+    AndroidWaitSet->uring.block = OFC_FALSE ;
+#endif
+
+  start = 0 ;
+  if (leastWait != 0)
+    start = android_wait_clock() ;
+
+  if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL)
+    android_wait_epoll(handle, AndroidWaitSet, leastWait, timed, result) ;
+#if defined(OFC_WAITSET_URING)
+  else if (AndroidWaitSet->backend == ANDROID_WAIT_URING)
+    android_wait_uring(handle, AndroidWaitSet, timed, result) ;
+#endif
+  else
+    android_wait_poll(handle, AndroidWaitSet, leastWait, timed, result) ;
+
+  __atomic_store_n (&AndroidWaitSet->sleeping, OFC_FALSE, __ATOMIC_SEQ_CST) ;
+  /*
+   * Signals that came while we weren't sleeping haven't woken us
+   */
+  if (__atomic_load_n (&AndroidWaitSet->notified, __ATOMIC_SEQ_CST) &&
+      !android_wait_result_full(result))
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      PollEvent(handle, AndroidWaitSet, result) ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+
+  if (start != 0)
+    {
+      result->blocked = android_wait_clock() - start + 1 ;
+      if (AndroidWaitSet->spin_max != 0)
+	android_wait_spin_adapt(AndroidWaitSet, result) ;
+    }
+}
+
+/*
+ * Called with the wait set locked at the end of a wait
+ */
+static OFC_VOID android_wait_stats_update(ANDROID_WAIT_SET *AndroidWaitSet,
+					  ANDROID_WAIT_RESULT *result)
+{
+  OFC_WAITSET_STATS *stats ;
+
+  stats = &AndroidWaitSet->stats ;
+  stats->waits++ ;
+  stats->scanned += result->scanned ;
+  android_wait_stats_hist(stats->scanned_hist, result->scanned) ;
+  if (result->spun)
+    {
+      stats->spins++ ;
+      if (result->spin_hit)
+	stats->spin_hits++ ;
+    }
+  if (result->blocked != 0)
+    {
+      stats->blocked++ ;
+      stats->blocked_usec += result->blocked / 1000 ;
+      android_wait_stats_hist(stats->blocked_hist, result->blocked / 1000) ;
+    }
+  if (AndroidWaitSet->signal_since != 0)
+    {
+      stats->signals++ ;
+      android_wait_stats_hist(stats->signal_hist,
+			      (android_wait_clock() -
+			       AndroidWaitSet->signal_since) / 1000) ;
+      AndroidWaitSet->signal_since = 0 ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Queue the handles a wait gathered
+ * on their classes.  Handles still queued from an earlier wait keep
+ * their place.
+ */
+static OFC_VOID android_wait_rank(ANDROID_WAIT_SET *AndroidWaitSet,
+				  ANDROID_WAIT_RESULT *result)
+{
+  ANDROID_WAIT_REG *reg ;
+  OFC_INT index ;
+
+  for (index = 0 ; index < result->num ; index++)
+    {
+      reg = result->regs[index] ;
+      if (!reg->removed && !reg->ranked)
+	android_wait_rank_reg(AndroidWaitSet, reg,
+			      result->ready[index].revents) ;
+    }
+}
+
+/*
+ * Called with the wait set locked.  Hand out queued handles, highest
+ * priority first.  A class that has watched ANDROID_WAIT_AGE higher
+ * priority handles go ahead of it goes next so every class makes
+ * progress.
+ *
+ * Only events, posted completions and claimed descriptors keep their
+ * place for the next wait, since testing an event consumed the signal,
+ * a completion has left the completion queue and a claimed descriptor
+ * isn't watched.  Anything else left over is found again by the next
+ * wait if it is still ready, so it isn't reported after it has been
+ * dealt with.  A completion is taken once it is handed out.  Claims on
+ * what is handed out pass to our waiter.
+ */
+static OFC_INT android_wait_dispatch(ANDROID_WAIT_SET *AndroidWaitSet,
+				     OFC_WAITSET_READY *ready,
+				     OFC_INT count)
+{
+  ANDROID_WAIT_CLASS *rank ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *next ;
+  OFC_INT num ;
+  OFC_INT priority ;
+  OFC_INT lower ;
+
+  for (num = 0 ; num < count && AndroidWaitSet->ranked > 0 ; num++)
+    {
+      for (priority = OFC_WAITSET_PRIORITIES - 1 ;
+	   priority >= 0 &&
+	     (AndroidWaitSet->classes[priority].head == OFC_NULL ||
+	      AndroidWaitSet->classes[priority].skipped < ANDROID_WAIT_AGE) ;
+	   priority--) ;
+      if (priority < 0)
+	for (priority = 0 ;
+	     AndroidWaitSet->classes[priority].head == OFC_NULL ;
+	     priority++) ;
+
+      rank = &AndroidWaitSet->classes[priority] ;
+      reg = rank->head ;
+      rank->head = reg->rank_next ;
+      if (rank->head == OFC_NULL)
+	rank->tail = OFC_NULL ;
+      rank->skipped = 0 ;
+      reg->ranked = OFC_FALSE ;
+      AndroidWaitSet->ranked-- ;
+
+      for (lower = priority + 1 ; lower < OFC_WAITSET_PRIORITIES ; lower++)
+	if (AndroidWaitSet->classes[lower].head != OFC_NULL)
+	  AndroidWaitSet->classes[lower].skipped++ ;
+
+      if (reg->claimed)
+	{
+	  reg->claim_next = AndroidWaitSet->claims ;
+	  AndroidWaitSet->claims = reg ;
+	}
+      reg->completed = OFC_FALSE ;
+      ready[num].hEvent = reg->hHandle ;
+      ready[num].revents = reg->revents ;
+    }
+
+  AndroidWaitSet->stealable = 0 ;
+  for (priority = 0 ;
+       priority < OFC_WAITSET_PRIORITIES && AndroidWaitSet->ranked > 0 ;
+       priority++)
+    {
+      rank = &AndroidWaitSet->classes[priority] ;
+      reg = rank->head ;
+      rank->head = OFC_NULL ;
+      rank->tail = OFC_NULL ;
+      while (reg != OFC_NULL)
+	{
+	  next = reg->rank_next ;
+	  AndroidWaitSet->ranked-- ;
+	  if (reg->claimed)
+	    AndroidWaitSet->stealable++ ;
+	  if (reg->type == OFC_HANDLE_EVENT || reg->completed || reg->claimed)
+	    android_wait_rank_reg(AndroidWaitSet, reg, reg->revents) ;
+	  else
+	    reg->ranked = OFC_FALSE ;
+	  reg = next ;
+	}
+    }
+  return (num) ;
+}
+
+/*
+ * Gather what is ready on a wait set, sleeping for it if block is set
+ */
+static OFC_INT android_wait_collect(OFC_HANDLE handle,
+				    ANDROID_WAIT_SET *AndroidWaitSet,
+				    OFC_WAITSET_READY *ready,
+				    OFC_INT count, OFC_BOOL block)
+{
+  ANDROID_WAIT_RESULT result ;
+
+  OFC_BOOL fds_checked ;
+  OFC_BOOL ranked ;
+
+  int leastWait ;
+  OFC_BOOL timed ;
+
+  result.ready = ready ;
+  result.regs = OFC_NULL ;
+  result.count = count ;
+  result.num = 0 ;
+  result.scanned = 0 ;
+  result.blocked = 0 ;
+  result.spun = OFC_FALSE ;
+  result.spin_hit = OFC_FALSE ;
+
+  ofc_lock (AndroidWaitSet->lock) ;
+  android_wait_reap(AndroidWaitSet, OFC_FALSE) ;
+  result.serial = ++AndroidWaitSet->serial ;
+
+  /*
+   * Grouped wait sets queue what they can't hand out so other
+   * wait sets in the group can take it
+   */
+  ranked = (AndroidWaitSet->prioritized > 0 ||
+	    AndroidWaitSet->ranked > 0 ||
+	    AndroidWaitSet->group != OFC_NULL) ;
+  if (ranked)
+    {
+      /*
+       * Gather everything ready so the most important can go
+       * first.  Don't sleep if something is still queued.
+       */
+      result.ready = AndroidWaitSet->batch ;
+      result.regs = AndroidWaitSet->batch_regs ;
+      result.count = ANDROID_WAIT_BATCH ;
+      if (AndroidWaitSet->ranked > 0)
+	block = OFC_FALSE ;
+    }
+
+  fds_checked = AndroidWaitSet->fd_starved ;
+  if (fds_checked)
+    {
+      /*
+       * The last wait was satisfied by events without looking at
+       * descriptors.  Give them the first chance this time.
+       */
+      AndroidWaitSet->fd_starved = OFC_FALSE ;
+      android_wait_descriptors(handle, AndroidWaitSet, 0, OFC_FALSE,
+			       &result) ;
+      ofc_lock (AndroidWaitSet->lock) ;
+    }
+
+  /*
+   * Sockets and files are registered with the kernel and are not
+   * visited here.  Of the other handles, only those signalled
+   * through the pending set need to be tested.
+   */
+  android_wait_drain(handle, AndroidWaitSet, &result) ;
+
+  leastWait = OFC_MAX_SCHED_WAIT ;
+  if (!android_wait_result_full(&result))
+    leastWait = android_wait_timers(handle, AndroidWaitSet, &result) ;
+
+  if (!android_wait_result_full(&result))
+    {
+      timed = block && leastWait < OFC_MAX_SCHED_WAIT ;
+      /*
+       * If something is already ready, just pick up whatever
+       * descriptors are also ready without sleeping.
+       */
+      if (result.num > 0 || !block)
+	leastWait = 0 ;
+
+      android_wait_descriptors(handle, AndroidWaitSet, leastWait, timed,
+			       &result) ;
+    }
+  else
+    {
+      if (!fds_checked && AndroidWaitSet->fd_list.count > 0)
+	AndroidWaitSet->fd_starved = OFC_TRUE ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+
+  ofc_lock (AndroidWaitSet->lock) ;
+  if (ranked)
+    {
+      android_wait_rank(AndroidWaitSet, &result) ;
+      result.num = android_wait_dispatch(AndroidWaitSet, ready, count) ;
+    }
+  android_wait_stats_update(AndroidWaitSet, &result) ;
+  ofc_unlock (AndroidWaitSet->lock) ;
+
+  return (result.num) ;
+}
+
+/*
+ * Release the claims our waiter holds, so the descriptors are watched
+ * again.  Claims on another wait set's registrations are released
+ * under the group lock, which keeps that wait set from going away.  A
+ * wait set that went away left the registration with the group.
+ */
+static OFC_VOID android_wait_unclaim(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  OFC_WAITSET_GROUP *group ;
+  ANDROID_WAIT_SET *owner ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG **link ;
+
+  group = AndroidWaitSet->group ;
+  while (AndroidWaitSet->claims != OFC_NULL)
+    {
+      reg = AndroidWaitSet->claims ;
+      AndroidWaitSet->claims = reg->claim_next ;
+      if (__atomic_load_n (&reg->wait_set, __ATOMIC_ACQUIRE) ==
+	  AndroidWaitSet)
+	{
+	  ofc_lock (AndroidWaitSet->lock) ;
+	  android_wait_rearm(AndroidWaitSet, reg, AndroidWaitSet) ;
+	  ofc_unlock (AndroidWaitSet->lock) ;
+	}
+      else
+	{
+	  ofc_lock (group->lock) ;
+	  owner = reg->wait_set ;
+	  if (owner != OFC_NULL)
+	    {
+	      ofc_lock (owner->lock) ;
+	      android_wait_rearm(owner, reg, AndroidWaitSet) ;
+	      ofc_unlock (owner->lock) ;
+	    }
+	  else
+	    {
+	      for (link = &group->orphans ; *link != reg ;
+		   link = &(*link)->next) ;
+	      *link = reg->next ;
+	      ofc_free (reg) ;
+	    }
+	  ofc_unlock (group->lock) ;
+	}
+    }
+}
+
+/*
+ * Take handles other wait sets in the group have reported but not yet
+ * handed out.  Only claimed descriptors are taken.  Events stay with
+ * their wait set since testing them is what consumed the signal.
+ */
+static OFC_INT android_wait_steal(ANDROID_WAIT_SET *AndroidWaitSet,
+				  OFC_WAITSET_READY *ready, OFC_INT count)
+{
+  OFC_WAITSET_GROUP *group ;
+  ANDROID_WAIT_SET *victim ;
+  ANDROID_WAIT_CLASS *rank ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *prev ;
+  ANDROID_WAIT_REG *next ;
+  OFC_INT num ;
+  OFC_INT index ;
+  OFC_INT priority ;
+
+  group = AndroidWaitSet->group ;
+  num = 0 ;
+
+  ofc_lock (group->lock) ;
+  for (index = 0 ; index < group->count && num < count ; index++)
+    {
+      victim = group->shards[(group->rotor + index) % group->count] ;
+      if (victim == AndroidWaitSet ||
+	  __atomic_load_n (&victim->stealable, __ATOMIC_RELAXED) == 0)
+	continue ;
+
+      ofc_lock (victim->lock) ;
+      for (priority = 0 ;
+	   priority < OFC_WAITSET_PRIORITIES && num < count ;
+	   priority++)
+	{
+	  rank = &victim->classes[priority] ;
+	  prev = OFC_NULL ;
+	  for (reg = rank->head ; reg != OFC_NULL && num < count ; reg = next)
+	    {
+	      next = reg->rank_next ;
+	      if (!reg->claimed)
+		{
+		  prev = reg ;
+		  continue ;
+		}
+	      if (prev == OFC_NULL)
+		rank->head = next ;
+	      else
+		prev->rank_next = next ;
+	      if (rank->tail == reg)
+		rank->tail = prev ;
+	      reg->ranked = OFC_FALSE ;
+	      victim->ranked-- ;
+	      victim->stealable-- ;
+
+	      reg->claim_next = AndroidWaitSet->claims ;
+	      AndroidWaitSet->claims = reg ;
+	      ready[num].hEvent = reg->hHandle ;
+	      ready[num].revents = reg->revents ;
+	      num++ ;
+	    }
+	}
+      ofc_unlock (victim->lock) ;
+    }
+  group->rotor++ ;
+  ofc_unlock (group->lock) ;
+
+  if (num > 0)
+    {
+      ofc_lock (AndroidWaitSet->lock) ;
+      AndroidWaitSet->stats.stolen += num ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+    }
+  return (num) ;
+}
+
+/*
+ * We left handles queued.  Wake a wait set in the group that is
+ * asleep so it can take some.
+ */
+static OFC_VOID android_wait_kick(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  OFC_WAITSET_GROUP *group ;
+  ANDROID_WAIT_SET *peer ;
+  OFC_INT index ;
+
+  group = AndroidWaitSet->group ;
+  ofc_lock (group->lock) ;
+  for (index = 0 ; index < group->count ; index++)
+    {
+      peer = group->shards[index] ;
+      if (peer != AndroidWaitSet &&
+	  __atomic_load_n (&peer->parked, __ATOMIC_RELAXED))
+	{
+	  android_wait_notify(peer) ;
+	  break ;
+	}
+    }
+  ofc_unlock (group->lock) ;
+}
+
+/*
+ * Called from destroy.  Nothing can be stolen from us once we're out
+ * of the group.  Registrations other waiters still hold claims on are
+ * left with the group and freed when the claim is released.
+ */
+static OFC_VOID android_wait_group_leave(ANDROID_WAIT_SET *AndroidWaitSet)
+{
+  OFC_WAITSET_GROUP *group ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *keep ;
+  OFC_INT index ;
+
+  group = AndroidWaitSet->group ;
+  android_wait_unclaim(AndroidWaitSet) ;
+
+  ofc_lock (group->lock) ;
+  for (index = 0 ; index < group->count ; index++)
+    {
+      if (group->shards[index] == AndroidWaitSet)
+	{
+	  group->count-- ;
+	  group->shards[index] = group->shards[group->count] ;
+	  group->handles[index] = group->handles[group->count] ;
+	  break ;
+	}
+    }
+
+  ofc_lock (AndroidWaitSet->lock) ;
+  while (AndroidWaitSet->fd_list.head != OFC_NULL)
+    android_wait_release(AndroidWaitSet, AndroidWaitSet->fd_list.head) ;
+
+  keep = OFC_NULL ;
+  while (AndroidWaitSet->zombies != OFC_NULL)
+    {
+      reg = AndroidWaitSet->zombies ;
+      AndroidWaitSet->zombies = reg->next ;
+      if (reg->claimed)
+	{
+	  __atomic_store_n (&reg->wait_set, OFC_NULL, __ATOMIC_RELEASE) ;
+	  reg->next = group->orphans ;
+	  group->orphans = reg ;
+	}
+      else
+	{
+	  reg->next = keep ;
+	  keep = reg ;
+	}
+    }
+  AndroidWaitSet->zombies = keep ;
+  AndroidWaitSet->group = OFC_NULL ;
+  ofc_unlock (AndroidWaitSet->lock) ;
+  ofc_unlock (group->lock) ;
+}
+
+/*
+ * Common body of ofc_waitset_wait_impl, ofc_waitset_wait_multi and
+ * ofc_waitset_poll_multi
+ */
+static OFC_INT android_wait(OFC_HANDLE handle, OFC_WAITSET_READY *ready,
+			    OFC_INT count, OFC_BOOL block)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  OFC_INT num ;
+
+  num = 0 ;
+  pWaitSet = ofc_handle_lock(handle) ;
+
+  if (pWaitSet != OFC_NULL && count > 0)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      /*
+       * Whatever we handed out last time has been dealt with
+       */
+      if (AndroidWaitSet->claims != OFC_NULL)
+	android_wait_unclaim(AndroidWaitSet) ;
+
+      if (AndroidWaitSet->group == OFC_NULL)
+	num = android_wait_collect(handle, AndroidWaitSet, ready, count,
+				   block) ;
+      else
+	{
+	  __atomic_store_n (&AndroidWaitSet->parked, block, __ATOMIC_RELAXED) ;
+	  num = android_wait_collect(handle, AndroidWaitSet, ready, count,
+				     block) ;
+	  __atomic_store_n (&AndroidWaitSet->parked, OFC_FALSE,
+			    __ATOMIC_RELAXED) ;
+	  if (num == 0)
+	    num = android_wait_steal(AndroidWaitSet, ready, count) ;
+	  else if (__atomic_load_n (&AndroidWaitSet->stealable,
+				    __ATOMIC_RELAXED) > 0)
+	    android_wait_kick(AndroidWaitSet) ;
+	}
+    }
+
+  if (pWaitSet != OFC_NULL)
+    ofc_handle_unlock(handle) ;
+
+  return (num) ;
+}
+
+
+OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
+{
+  OFC_WAITSET_READY ready ;
+  OFC_HANDLE triggered_event ;
+
+  triggered_event = OFC_HANDLE_NULL ;
+  if (android_wait(handle, &ready, 1, OFC_TRUE) == 1)
+    triggered_event = ready.hEvent ;
+
+  return (triggered_event) ;
+}
+
+OFC_INT ofc_waitset_wait_multi(OFC_HANDLE hSet, OFC_WAITSET_READY *ready,
+                               OFC_INT count)
+{
+  return (android_wait(hSet, ready, count, OFC_TRUE)) ;
+}
+
+OFC_INT ofc_waitset_poll_multi(OFC_HANDLE hSet, OFC_WAITSET_READY *ready,
+                               OFC_INT count)
+{
+  return (android_wait(hSet, ready, count, OFC_FALSE)) ;
+}
+
+OFC_VOID ofc_waitset_set_priority(OFC_HANDLE hSet, OFC_HANDLE hEvent,
+                                  OFC_WAITSET_PRIORITY priority)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *reg ;
+  OFC_BOOL queued ;
 
+  pWaitSet = ofc_handle_lock(hSet) ;
   if (pWaitSet != OFC_NULL)
     {
-      eventQueue = ofc_queue_create() ;
-      leastWait = OFC_MAX_SCHED_WAIT ;
-      timer_event = OFC_HANDLE_NULL ;
-
-      wait_count = 0 ;
-      android_handle_list = ofc_malloc(sizeof (struct pollfd)) ;
-      ofc_handle_list = ofc_malloc(sizeof (OFC_HANDLE)) ;
-
       AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (AndroidWaitSet->lock) ;
+      reg = android_wait_index_find(&AndroidWaitSet->handles, hEvent) ;
+      if (reg != OFC_NULL && priority < OFC_WAITSET_PRIORITIES &&
+	  reg->priority != priority)
+	{
+	  /*
+	   * A handle waiting to be dispatched moves to its new class
+	   */
+	  queued = reg->ranked ;
+	  if (queued)
+	    android_wait_unrank(AndroidWaitSet, reg) ;
+	  if (reg->priority != OFC_WAITSET_PRIORITY_NORMAL)
+	    AndroidWaitSet->prioritized-- ;
+	  reg->priority = priority ;
+	  if (reg->priority != OFC_WAITSET_PRIORITY_NORMAL)
+	    AndroidWaitSet->prioritized++ ;
+	  if (queued)
+	    android_wait_rank_reg(AndroidWaitSet, reg, reg->revents) ;
+	}
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+    }
+}
 
-      /*
-       * Purge any additional queued events.  We'll get these before we
-       * sleep the next time
-       */
-      while (read (AndroidWaitSet->pipe_files[0], &hEventHandle,
-		   sizeof (OFC_HANDLE)) > 0) ;
-
-      android_handle_list[wait_count].fd = AndroidWaitSet->pipe_files[0] ;
-      android_handle_list[wait_count].events = POLLIN ;
-      android_handle_list[wait_count].revents = 0 ;
-      ofc_handle_list[wait_count] = OFC_HANDLE_NULL ;
-
-      wait_count++ ;
+OFC_BOOL ofc_waitset_complete(OFC_HANDLE hOverlapped)
+{
+  OFC_HANDLE hSet ;
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *reg ;
+  OFC_BOOL ret ;
 
-      for (hEventHandle =
-	     (OFC_HANDLE) ofc_queue_first (pWaitSet->hHandleQueue) ;
-	   hEventHandle != OFC_HANDLE_NULL &&
-	     triggered_event == OFC_HANDLE_NULL ;
-	   hEventHandle =
-	     (OFC_HANDLE) ofc_queue_next (pWaitSet->hHandleQueue,
-				      (OFC_VOID *) hEventHandle) )
+  ret = OFC_FALSE ;
+  hSet = ofc_handle_get_wait_set(hOverlapped) ;
+  if (hSet != OFC_HANDLE_NULL)
+    {
+      pWaitSet = ofc_handle_lock(hSet) ;
+      if (pWaitSet != OFC_NULL)
 	{
-	  switch (ofc_handle_get_type(hEventHandle))
+	  AndroidWaitSet = pWaitSet->impl ;
+	  ofc_lock (AndroidWaitSet->lock) ;
+	  reg = android_wait_index_find(&AndroidWaitSet->handles,
+					hOverlapped) ;
+	  if (reg != OFC_NULL &&
+	      (reg->type == OFC_HANDLE_FSANDROID_OVERLAPPED ||
+	       reg->type == OFC_HANDLE_FSRESOLVER_OVERLAPPED ||
+	       reg->type == OFC_HANDLE_FSSMB_OVERLAPPED))
 	    {
-	    default:
-	    case OFC_HANDLE_WAIT_SET:
-	    case OFC_HANDLE_SCHED:
-	    case OFC_HANDLE_APP:
-	    case OFC_HANDLE_THREAD:
-	    case OFC_HANDLE_PIPE:
-	    case OFC_HANDLE_MAILSLOT:
-	    case OFC_HANDLE_FSWIN32_FILE:
-	    case OFC_HANDLE_FSANDROID_FILE:
-	    case OFC_HANDLE_QUEUE:
 	      /*
-	       * These are not synchronizeable.  Simple ignore
+	       * Its file system posts completions, so there's no need to
+	       * test its event any more
 	       */
-	      break ;
-
-	    case OFC_HANDLE_WAIT_QUEUE:
-	      hEvent = ofc_waitq_get_event_handle(hEventHandle) ;
-	      if (!ofc_waitq_empty(hEventHandle))
+	      if (reg->list == &AndroidWaitSet->event_list)
 		{
-		  triggered_event = hEventHandle ;
+		  if (AndroidWaitSet->cursor == reg)
+		    AndroidWaitSet->cursor = reg->next ;
+		  android_wait_list_remove(&AndroidWaitSet->event_list, reg) ;
+		  reg->list = &AndroidWaitSet->posted_list ;
+		  android_wait_list_append(reg->list, reg) ;
 		}
-	      else
+	      if (!reg->completed)
 		{
-		  eventElement = ofc_malloc(sizeof (EVENT_ELEMENT)) ;
-		  eventElement->hAssoc = hEventHandle ;
-		  eventElement->hEvent = hEvent ;
-		  ofc_enqueue (eventQueue, eventElement) ;
+		  reg->completed = OFC_TRUE ;
+		  reg->complete_next = OFC_NULL ;
+		  if (AndroidWaitSet->completed_tail != OFC_NULL)
+		    AndroidWaitSet->completed_tail->complete_next = reg ;
+		  else
+		    AndroidWaitSet->completed_head = reg ;
+		  AndroidWaitSet->completed_tail = reg ;
 		}
-	      break ;
-
-	    case OFC_HANDLE_FILE:
-#if defined(OFC_FS_ANDROID)
-	      fsType = OfcFileGetFSType(hEventHandle) ;
+	      ret = OFC_TRUE ;
+	    }
+	  ofc_unlock (AndroidWaitSet->lock) ;
+	  if (ret)
+	    android_wait_notify(AndroidWaitSet) ;
+	  ofc_handle_unlock(hSet) ;
+	}
+    }
+  return (ret) ;
+}
 
-	      if (fsType == OFC_FST_ANDROID)
-		{
-		  android_handle_list =
-		    ofc_realloc(android_handle_list,
-				sizeof (struct pollfd) * (wait_count+1)) ;
-		  ofc_handle_list =
-		    ofc_realloc(ofc_handle_list,
-				     sizeof (OFC_HANDLE) * (wait_count+1)) ;
-		  fsHandle = OfcFileGetFSHandle (hEventHandle) ;
-		  android_handle_list[wait_count].fd =
-		    OfcFSAndroidGetFD (fsHandle) ;
-		  android_handle_list[wait_count].events = 0 ;
-		  android_handle_list[wait_count].revents = 0 ;
-		  ofc_handle_list[wait_count] = hEventHandle ;
-		  wait_count++ ;
-		}
-#endif
-	      break ;
-	    case OFC_HANDLE_SOCKET:
-	      /*
-	       * Wait on event
-	       */
-	      android_handle_list =
-		ofc_realloc(android_handle_list,
-				 sizeof (struct pollfd) * (wait_count+1)) ;
-	      ofc_handle_list =
-		ofc_realloc(ofc_handle_list,
-				 sizeof (OFC_HANDLE) * (wait_count+1)) ;
-
-	      androidHandle = ofc_socket_get_impl(hEventHandle) ;
-	      android_handle_list[wait_count].fd =
-		ofc_socket_impl_get_fd(androidHandle) ;
-	      android_handle_list[wait_count].events =
-		ofc_socket_impl_get_event(androidHandle) ;
-	      android_handle_list[wait_count].revents = 0 ;
-	      ofc_handle_list[wait_count] = hEventHandle ;
-	      wait_count++ ;
-	      break ;
-
-	    case OFC_HANDLE_FSRESOLVER_OVERLAPPED:
-#if defined(OF_RESOLVER_FS)
-              hEvent =
-                ofc_android_get_resolver_overlapped_event(hEventHandle);
-	      if (ofc_event_test(hEvent))
-		{
-		  triggered_event = hEventHandle ;
-		}
-	      else
-		{
-		  eventElement = ofc_malloc(sizeof (EVENT_ELEMENT)) ;
-		  eventElement->hAssoc = hEventHandle ;
-		  eventElement->hEvent = hEvent ;
-		  ofc_enqueue(eventQueue, eventElement) ;
-		}
-#endif
-	      break ;
+OFC_WAITSET_GROUP *ofc_waitset_group_create(OFC_VOID)
+{
+  OFC_WAITSET_GROUP *group ;
 
-	    case OFC_HANDLE_FSANDROID_OVERLAPPED:
-#if defined(OFC_FS_ANDROID)
-	      hEvent = OfcFSAndroidGetOverlappedEvent (hEventHandle) ;
-	      if (ofc_event_test(hEvent))
-		{
-		  triggered_event = hEventHandle ;
-		}
-	      else
-		{
-		  eventElement = ofc_malloc(sizeof (EVENT_ELEMENT)) ;
-		  eventElement->hAssoc = hEventHandle ;
-		  eventElement->hEvent = hEvent ;
-		  ofc_enqueue(eventQueue, eventElement) ;
-		}
-#endif
-	      break ;
+  group = ofc_malloc (sizeof (OFC_WAITSET_GROUP)) ;
+  if (group != OFC_NULL)
+    {
+      group->lock = ofc_lock_init() ;
+      group->count = 0 ;
+      group->rotor = 0 ;
+      group->orphans = OFC_NULL ;
+    }
+  return (group) ;
+}
 
-	    case OFC_HANDLE_FSSMB_OVERLAPPED:
-	      hWaitQ = OfcFileGetOverlappedWaitQ (hEventHandle) ;
-	      hEvent = ofc_waitq_get_event_handle(hWaitQ) ;
+OFC_VOID ofc_waitset_group_destroy(OFC_WAITSET_GROUP *group)
+{
+  ANDROID_WAIT_REG *reg ;
 
-	      if (!ofc_waitq_empty(hWaitQ))
-		{
-		  triggered_event = hEventHandle ;
-		}
-	      else
-		{
-		  eventElement = ofc_malloc(sizeof (EVENT_ELEMENT)) ;
-		  eventElement->hAssoc = hEventHandle ;
-		  eventElement->hEvent = hEvent ;
-		  ofc_enqueue(eventQueue, eventElement) ;
-		}
-	      break ;
+  while (group->orphans != OFC_NULL)
+    {
+      reg = group->orphans ;
+      group->orphans = reg->next ;
+      ofc_free (reg) ;
+    }
+  ofc_lock_destroy (group->lock) ;
+  ofc_free (group) ;
+}
 
-	    case OFC_HANDLE_EVENT:
-	      if (ofc_event_test(hEventHandle))
-		{
-		  triggered_event = hEventHandle ;
-		  if (ofc_event_get_type(hEventHandle) == OFC_EVENT_AUTO)
-		    ofc_event_reset (hEventHandle) ;
-		}
-	      else
-		{
-		  eventElement = ofc_malloc(sizeof (EVENT_ELEMENT)) ;
-		  eventElement->hAssoc = hEventHandle ;
-		  eventElement->hEvent = hEventHandle ;
-		  ofc_enqueue(eventQueue, eventElement) ;
-		}
-	      break ;
+OFC_BOOL ofc_waitset_group_join(OFC_WAITSET_GROUP *group, OFC_HANDLE hSet)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *reg ;
+  struct epoll_event event ;
+  OFC_BOOL ret ;
 
-	    case OFC_HANDLE_TIMER:
-	      wait_time = ofc_timer_get_wait_time(hEventHandle) ;
-	      if (wait_time == 0)
-		triggered_event = hEventHandle ;
-	      else
+  ret = OFC_FALSE ;
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (group->lock) ;
+      if (AndroidWaitSet->group == OFC_NULL &&
+	  group->count < ANDROID_WAIT_SHARDS)
+	{
+	  ofc_lock (AndroidWaitSet->lock) ;
+	  AndroidWaitSet->group = group ;
+	  /*
+	   * Descriptors already registered become one shot
+	   */
+	  if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL)
+	    {
+	      for (reg = AndroidWaitSet->fd_list.head ; reg != OFC_NULL ;
+		   reg = reg->next)
 		{
-		  if (wait_time < leastWait)
+		  if (reg->fd != -1)
 		    {
-		      leastWait = wait_time ;
-		      timer_event = hEventHandle ;
+		      event.events = reg->events | EPOLLONESHOT ;
+		      event.data.ptr = reg ;
+		      epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_MOD,
+				 reg->fd, &event) ;
 		    }
 		}
-	      break ;
-
 	    }
+	  ofc_unlock (AndroidWaitSet->lock) ;
+
+	  group->shards[group->count] = AndroidWaitSet ;
+	  group->handles[group->count] = hSet ;
+	  group->count++ ;
+	  ret = OFC_TRUE ;
 	}
+      ofc_unlock (group->lock) ;
+      ofc_handle_unlock(hSet) ;
+    }
+  return (ret) ;
+}
 
-      if (triggered_event == OFC_HANDLE_NULL)
-	{
-	  poll_count = poll (android_handle_list, wait_count, leastWait) ;
-	  if (poll_count == 0 && timer_event != OFC_HANDLE_NULL)
-	    triggered_event = timer_event ;
-	  else if (poll_count > 0)
-	    {
-	      for (wait_index = 0 ;
-		   (wait_index < wait_count &&
-		    android_handle_list[wait_index].revents == 0) ;
-		   wait_index++) ;
+OFC_HANDLE ofc_waitset_group_select(OFC_WAITSET_GROUP *group,
+                                    OFC_HANDLE hSocket)
+{
+  OFC_HANDLE hSet ;
+  int fd ;
+  int index ;
+#if defined(SO_INCOMING_CPU)
+  int cpu ;
+  socklen_t len ;
+#endif
 
-	      if (wait_index == 0)
-		triggered_event =
-		  PollEvent(AndroidWaitSet->pipe_files[0], eventQueue) ;
-	      else if (wait_index < wait_count)
-		{
-		  ofc_socket_impl_set_event
-		    (ofc_socket_get_impl(ofc_handle_list[wait_index]),
-		     android_handle_list[wait_index].revents) ;
+  hSet = OFC_HANDLE_NULL ;
+  fd = ofc_socket_impl_get_fd(ofc_socket_get_impl(hSocket)) ;
+  index = fd < 0 ? 0 : fd ;
+#if defined(SO_INCOMING_CPU)
+  /*
+   * Keep the connection on the wait set for the processor its packets
+   * arrive on
+   */
+  len = sizeof (cpu) ;
+  if (fd != -1 &&
+      getsockopt (fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+      cpu >= 0)
+    index = cpu ;
+#endif
 
-		  if (android_handle_list[wait_index].revents != 0)
-		    triggered_event = ofc_handle_list[wait_index] ;
-		}
-	    }
-	}
+  ofc_lock (group->lock) ;
+  if (group->count > 0)
+    hSet = group->handles[index % group->count] ;
+  ofc_unlock (group->lock) ;
 
-      for (eventElement = ofc_dequeue (eventQueue) ;
-	   eventElement != OFC_NULL ;
-	   eventElement = ofc_dequeue (eventQueue))
-	ofc_free (eventElement) ;
+  return (hSet) ;
+}
 
-      ofc_queue_destroy (eventQueue) ;
+OFC_BOOL ofc_waitset_get_stats(OFC_HANDLE hSet, OFC_WAITSET_STATS *stats)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  OFC_BOOL ret ;
 
-      ofc_free(android_handle_list) ;
-      ofc_free(ofc_handle_list) ;
+  ret = OFC_FALSE ;
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (AndroidWaitSet->lock) ;
+      *stats = AndroidWaitSet->stats ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
 
-      ofc_handle_unlock(handle) ;
+OFC_VOID ofc_waitset_reset_stats(OFC_HANDLE hSet)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (AndroidWaitSet->lock) ;
+      ofc_memset (&AndroidWaitSet->stats, '\0', sizeof (OFC_WAITSET_STATS)) ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+    }
+}
+
+OFC_VOID ofc_waitset_set_busy_poll(OFC_HANDLE hSet, OFC_UINT32 usec)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (AndroidWaitSet->lock) ;
+      AndroidWaitSet->spin_max = (OFC_UINT64) usec * 1000 ;
+      AndroidWaitSet->spin_budget = AndroidWaitSet->spin_max ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+    }
+}
+
+static OFC_VOID android_wait_log(OFC_CCHAR *obuf)
+{
+  ofc_write_log_impl(OFC_LOG_INFO, obuf, ofc_strlen(obuf)) ;
+}
+
+static OFC_VOID android_wait_log_hist(OFC_CCHAR *name, OFC_UINT32 *hist)
+{
+  OFC_CHAR obuf[OFC_WAITSET_STATS_BUCKETS * 11 + 32] ;
+  OFC_SIZET len ;
+  OFC_INT bucket ;
+
+  len = ofc_snprintf (obuf, sizeof (obuf), "  %s:", name) ;
+  for (bucket = 0 ; bucket < OFC_WAITSET_STATS_BUCKETS ; bucket++)
+    len += ofc_snprintf (obuf + len, sizeof (obuf) - len, " %u",
+			 hist[bucket]) ;
+  ofc_snprintf (obuf + len, sizeof (obuf) - len, "\n") ;
+  android_wait_log(obuf) ;
+}
+
+OFC_VOID ofc_waitset_log_stats(OFC_HANDLE hSet)
+{
+  OFC_WAITSET_STATS stats ;
+  OFC_CHAR obuf[200] ;
+
+  if (ofc_waitset_get_stats(hSet, &stats))
+    {
+      ofc_snprintf (obuf, sizeof (obuf),
+		    "Wait Set Statistics\n"
+		    "  waits %llu, blocked %llu for %llu us, "
+		    "signals %llu, spurious %llu, scanned %llu, "
+		    "spins %llu, spin hits %llu\n",
+		    (unsigned long long) stats.waits,
+		    (unsigned long long) stats.blocked,
+		    (unsigned long long) stats.blocked_usec,
+		    (unsigned long long) stats.signals,
+		    (unsigned long long) stats.spurious,
+		    (unsigned long long) stats.scanned,
+		    (unsigned long long) stats.spins,
+		    (unsigned long long) stats.spin_hits) ;
+      android_wait_log(obuf) ;
+      ofc_snprintf (obuf, sizeof (obuf),
+		    "  dispatched: event %llu, waitq %llu, timer %llu, "
+		    "socket %llu, file %llu, overlapped %llu, other %llu\n",
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_EVENT],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_WAIT_QUEUE],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_TIMER],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_SOCKET],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_FILE],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_OVERLAPPED],
+		    (unsigned long long)
+		    stats.dispatched[OFC_WAITSET_STATS_OTHER]) ;
+      android_wait_log(obuf) ;
+      if (stats.stolen > 0)
+	{
+	  ofc_snprintf (obuf, sizeof (obuf), "  stolen %llu\n",
+			(unsigned long long) stats.stolen) ;
+	  android_wait_log(obuf) ;
+	}
+      android_wait_log_hist("blocked us", stats.blocked_hist) ;
+      android_wait_log_hist("signal us", stats.signal_hist) ;
+      android_wait_log_hist("scanned", stats.scanned_hist) ;
     }
-  return (triggered_event) ;
 }
 
 OFC_VOID ofc_waitset_set_assoc_impl(OFC_HANDLE hEvent,
                                     OFC_HANDLE hApp, OFC_HANDLE hSet)
 {
   OFC_HANDLE hAssoc ;
+  OFC_HANDLE hOwner ;
+
+  /*
+   * This is how the core removes a handle from its wait set and how a
+   * handle added to another wait set leaves the one it was in.  Drop
+   * any registration it has with a wait set it no longer belongs to.
+   */
+  hOwner = android_wait_owner_find(hEvent, hSet) ;
+  if (hOwner != OFC_HANDLE_NULL)
+    ofc_waitset_remove_impl(hOwner, hEvent) ;
 
   switch (ofc_handle_get_type(hEvent))
     {
     default:
-    case OFC_HANDLE_WAIT_SET:
     case OFC_HANDLE_SCHED:
     case OFC_HANDLE_APP:
     case OFC_HANDLE_THREAD:
@@ -493,6 +3621,7 @@ OFC_VOID ofc_waitset_set_assoc_impl(OFC_HANDLE hEvent,
     case OFC_HANDLE_FILE:
     case OFC_HANDLE_SOCKET:
     case OFC_HANDLE_TIMER:
+    case OFC_HANDLE_WAIT_SET:
       /*
        * These don't need to set associated events
        */
@@ -500,15 +3629,286 @@ OFC_VOID ofc_waitset_set_assoc_impl(OFC_HANDLE hEvent,
     }
 }
 
+/*
+ * Find the event that is signalled when a handle may have become ready
+ */
+static OFC_HANDLE android_wait_get_event(OFC_HANDLE hEvent,
+					 OFC_HANDLE_TYPE type)
+{
+  OFC_HANDLE hAssoc ;
+
+  hAssoc = OFC_HANDLE_NULL ;
+  switch (type)
+    {
+    default:
+      break ;
+
+    case OFC_HANDLE_WAIT_QUEUE:
+      hAssoc = ofc_waitq_get_event_handle(hEvent) ;
+      break ;
+
+    case OFC_HANDLE_FSRESOLVER_OVERLAPPED:
+#if defined(OF_RESOLVER_FS)
+      hAssoc = ofc_android_get_resolver_overlapped_event(hEvent) ;
+#endif
+      break ;
+
+    case OFC_HANDLE_FSANDROID_OVERLAPPED:
+#if defined(OFC_FS_ANDROID)
+      hAssoc = OfcFSAndroidGetOverlappedEvent (hEvent) ;
+#endif
+      break ;
+
+    case OFC_HANDLE_FSSMB_OVERLAPPED:
+      hAssoc = ofc_waitq_get_event_handle(OfcFileGetOverlappedWaitQ (hEvent)) ;
+      break ;
+
+    case OFC_HANDLE_EVENT:
+      hAssoc = hEvent ;
+      break ;
+    }
+  return (hAssoc) ;
+}
+
+/*
+ * Find the descriptor that becomes readable when a wait set may have
+ * something ready and note the wait set it is being nested in.  That
+ * is the epoll or io_uring descriptor when it has one.  Otherwise it
+ * is the wake channel, through which only signals are seen.
+ */
+static int android_wait_nest(OFC_HANDLE hSet, OFC_HANDLE hChild)
+{
+  WAIT_SET *pChild ;
+  ANDROID_WAIT_SET *child ;
+  int fd ;
+
+  fd = -1 ;
+  pChild = ofc_handle_lock(hChild) ;
+  if (pChild != OFC_NULL)
+    {
+      child = pChild->impl ;
+      ofc_lock (child->lock) ;
+      child->hParent = hSet ;
+      child->hSelf = hChild ;
+      /*
+       * Signals the child had before now didn't write its wake
+       * channel.  Have the next one write it for the parent to see.
+       */
+      __atomic_store_n (&child->notified, OFC_FALSE, __ATOMIC_SEQ_CST) ;
+      if (child->backend == ANDROID_WAIT_EPOLL)
+	fd = child->epoll_fd ;
+#if defined(OFC_WAITSET_URING)
+      else if (child->backend == ANDROID_WAIT_URING)
+	fd = child->uring.fd ;
+#endif
+      else
+	fd = child->wake_files[0] ;
+      ofc_unlock (child->lock) ;
+      ofc_handle_unlock(hChild) ;
+    }
+  return (fd) ;
+}
+
+/*
+ * Record a handle with the wait set and, for sockets and files, hand
+ * its descriptor to the kernel.  Handles that are not synchronizeable
+ * are not recorded.
+ */
+static OFC_VOID android_wait_register(OFC_HANDLE hSet, OFC_HANDLE hEvent)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *reg ;
+  ANDROID_WAIT_REG *old ;
+  OFC_SOCKET_WATCH replaced ;
+  OFC_HANDLE_TYPE type ;
+  OFC_UINT16 events ;
+  struct epoll_event event ;
+#if defined(OFC_FS_ANDROID)
+  OFC_HANDLE fsHandle ;
+#endif
+
+  type = ofc_handle_get_type(hEvent) ;
+  switch (type)
+    {
+    default:
+      return ;
+
+    case OFC_HANDLE_WAIT_QUEUE:
+    case OFC_HANDLE_EVENT:
+    case OFC_HANDLE_FSRESOLVER_OVERLAPPED:
+    case OFC_HANDLE_FSANDROID_OVERLAPPED:
+    case OFC_HANDLE_FSSMB_OVERLAPPED:
+    case OFC_HANDLE_TIMER:
+    case OFC_HANDLE_SOCKET:
+      break ;
+
+    case OFC_HANDLE_WAIT_SET:
+      if (hEvent == hSet)
+	return ;
+      break ;
+
+    case OFC_HANDLE_FILE:
+#if defined(OFC_FS_ANDROID)
+      if (OfcFileGetFSType(hEvent) != OFC_FST_ANDROID)
+	return ;
+      break ;
+#else
+      return ;
+#endif
+    }
+
+  replaced.close = OFC_NULL ;
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+
+      ofc_lock (AndroidWaitSet->lock) ;
+
+      reg = android_wait_reg_alloc(AndroidWaitSet) ;
+      reg->watch.update = android_wait_socket_update ;
+      reg->watch.close = android_wait_socket_close ;
+      reg->watch.events = OFC_NULL ;
+      reg->watch.serial = 0 ;
+      reg->watch.hOwner = hSet ;
+      reg->watch.hTarget = hEvent ;
+      reg->wait_set = AndroidWaitSet ;
+      reg->hWaitSet = hSet ;
+      reg->hHandle = hEvent ;
+      reg->type = type ;
+      reg->hEvent = android_wait_get_event(hEvent, type) ;
+      reg->hSocket = OFC_HANDLE_NULL ;
+      reg->watch.revents = OFC_NULL ;
+      reg->fd = -1 ;
+      reg->events = 0 ;
+      reg->removed = OFC_FALSE ;
+      reg->serial = AndroidWaitSet->serial ;
+      reg->timer_index = -1 ;
+      reg->uring_pending = OFC_FALSE ;
+      reg->uring_queued = OFC_FALSE ;
+      reg->nest_next = OFC_NULL ;
+      reg->priority = OFC_WAITSET_PRIORITY_NORMAL ;
+      reg->ranked = OFC_FALSE ;
+      reg->claimed = OFC_FALSE ;
+      reg->completed = OFC_FALSE ;
+      reg->list = &AndroidWaitSet->event_list ;
+      events = 0 ;
+
+      /*
+       * A handle added twice replaces its earlier registration
+       */
+      old = android_wait_index_find(&AndroidWaitSet->handles, hEvent) ;
+      if (old != OFC_NULL)
+	android_wait_release(AndroidWaitSet, old) ;
+
+      if (type == OFC_HANDLE_SOCKET)
+	{
+	  reg->hSocket = ofc_socket_get_impl(hEvent) ;
+	  reg->fd = ofc_socket_impl_watch(reg->hSocket, &reg->watch,
+					  &events, &replaced) ;
+	  reg->events = events ;
+	  reg->list = &AndroidWaitSet->fd_list ;
+	}
+      else if (type == OFC_HANDLE_TIMER)
+	{
+	  reg->deadline = android_wait_clock() +
+	    (OFC_UINT64) ofc_timer_get_wait_time(hEvent) * 1000000 ;
+	  reg->list = &AndroidWaitSet->timer_list ;
+	  android_wait_timer_insert(AndroidWaitSet, reg) ;
+	}
+      else if (type == OFC_HANDLE_WAIT_SET)
+	{
+	  reg->fd = android_wait_nest(hSet, hEvent) ;
+	  reg->events = POLLIN ;
+	  events = reg->events ;
+	  reg->list = &AndroidWaitSet->fd_list ;
+	  reg->nest_next = AndroidWaitSet->nested ;
+	  AndroidWaitSet->nested = reg ;
+	}
+#if defined(OFC_FS_ANDROID)
+      else if (type == OFC_HANDLE_FILE)
+	{
+	  fsHandle = OfcFileGetFSHandle (hEvent) ;
+	  reg->fd = OfcFSAndroidGetFD (fsHandle) ;
+	  reg->list = &AndroidWaitSet->fd_list ;
+	}
+#endif
+
+      if (AndroidWaitSet->backend == ANDROID_WAIT_EPOLL && reg->fd != -1)
+	{
+	  event.events = events ;
+	  if (AndroidWaitSet->group != OFC_NULL)
+	    event.events |= EPOLLONESHOT ;
+	  event.data.ptr = reg ;
+	  /*
+	   * Regular files can't be added to an epoll set.  That's ok,
+	   * they never become ready anyway.
+	   */
+	  epoll_ctl (AndroidWaitSet->epoll_fd, EPOLL_CTL_ADD, reg->fd, &event) ;
+	}
+#if defined(OFC_WAITSET_URING)
+      if (AndroidWaitSet->backend == ANDROID_WAIT_URING && reg->fd != -1)
+	{
+	  android_wait_uring_queue(AndroidWaitSet, reg) ;
+	  android_wait_notify(AndroidWaitSet) ;
+	}
+#endif
+
+      reg->handle_link.key = reg->hHandle ;
+      reg->handle_link.reg = reg ;
+      android_wait_index_insert(&AndroidWaitSet->handles, &reg->handle_link) ;
+      if (reg->hEvent != OFC_HANDLE_NULL)
+	{
+	  reg->event_link.key = reg->hEvent ;
+	  reg->event_link.reg = reg ;
+	  android_wait_index_insert(&AndroidWaitSet->events, &reg->event_link) ;
+	}
+      android_wait_owner_insert(reg) ;
+      android_wait_list_append(reg->list, reg) ;
+      AndroidWaitSet->dirty = OFC_TRUE ;
+
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+
+      /*
+       * The wait set the socket was in stops using it.  That takes its
+       * lock, so ours must not be held.
+       */
+      if (replaced.close != OFC_NULL)
+	replaced.close(&replaced) ;
+    }
+}
+
+OFC_VOID ofc_waitset_remove_impl(OFC_HANDLE hSet, OFC_HANDLE hEvent)
+{
+  WAIT_SET *pWaitSet ;
+  ANDROID_WAIT_SET *AndroidWaitSet ;
+  ANDROID_WAIT_REG *reg ;
+
+  pWaitSet = ofc_handle_lock(hSet) ;
+  if (pWaitSet != OFC_NULL)
+    {
+      AndroidWaitSet = pWaitSet->impl ;
+      ofc_lock (AndroidWaitSet->lock) ;
+      reg = android_wait_index_find(&AndroidWaitSet->handles, hEvent) ;
+      if (reg != OFC_NULL)
+	android_wait_release(AndroidWaitSet, reg) ;
+      ofc_unlock (AndroidWaitSet->lock) ;
+      ofc_handle_unlock(hSet) ;
+    }
+}
+
 OFC_VOID ofc_waitset_add_impl(OFC_HANDLE hSet, OFC_HANDLE hApp,
                               OFC_HANDLE hEvent)
 {
   OFC_HANDLE hAssoc ;
 
+  android_wait_register(hSet, hEvent) ;
+
   switch (ofc_handle_get_type(hEvent))
     {
     default:
-    case OFC_HANDLE_WAIT_SET:
     case OFC_HANDLE_SCHED:
     case OFC_HANDLE_APP:
     case OFC_HANDLE_THREAD:
@@ -558,11 +3958,20 @@ OFC_VOID ofc_waitset_add_impl(OFC_HANDLE hSet, OFC_HANDLE hApp,
 	ofc_waitset_signal_impl(hSet, hAssoc) ;
       break ;
 
+    case OFC_HANDLE_WAIT_SET:
+      /*
+       * Something in the nested wait set may already be ready.  Wake
+       * it so we look at it once.
+       */
+      ofc_waitset_wake_impl(hEvent) ;
+      break ;
+
     case OFC_HANDLE_FILE:
     case OFC_HANDLE_SOCKET:
     case OFC_HANDLE_TIMER:
       /*
-       * These don't need to set associated events
+       * These don't need to set associated events.  Sockets and files
+       * were registered with the kernel above.
        */
       break ;
     }
@@ -0,0 +1,148 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ofc/types.h"
+#include "ofc/lock.h"
+#include "ofc/framework.h"
+
+#include "ofc_android/lock_android.h"
+
+/*
+ * Compare the cost of a lock/unlock pair on a fast lock with one on a
+ * recursive lock.  Every thread takes the same lock, so more than one
+ * thread measures the contended path.
+ *
+ *   bench_fast_lock [threads [pairs per thread]]
+ */
+#define BENCH_THREADS 1
+#define BENCH_PAIRS 1000000
+
+static OFC_FAST_LOCK bench_fast = OFC_FAST_LOCK_INIT ;
+static OFC_LOCK bench_lock ;
+static OFC_BOOL bench_use_fast ;
+static OFC_INT bench_pairs ;
+static OFC_UINT64 bench_count ;
+static pthread_barrier_t bench_start ;
+
+static OFC_UINT64 bench_now(OFC_VOID)
+{
+  struct timespec now ;
+
+  clock_gettime (CLOCK_MONOTONIC, &now) ;
+  return ((OFC_UINT64) now.tv_sec * 1000000000 + now.tv_nsec) ;
+}
+
+static OFC_VOID *bench_thread(OFC_VOID *arg)
+{
+  OFC_INT pair ;
+
+  pthread_barrier_wait (&bench_start) ;
+  if (bench_use_fast)
+    {
+      for (pair = 0 ; pair < bench_pairs ; pair++)
+	{
+	  ofc_fast_lock (&bench_fast) ;
+	  bench_count++ ;
+	  ofc_fast_unlock (&bench_fast) ;
+	}
+    }
+  else
+    {
+      for (pair = 0 ; pair < bench_pairs ; pair++)
+	{
+	  ofc_lock (bench_lock) ;
+	  bench_count++ ;
+	  ofc_unlock (bench_lock) ;
+	}
+    }
+  return (OFC_NULL) ;
+}
+
+/*
+ * Returns nanoseconds per pair, or a negative number if the lock let
+ * two threads in at once
+ */
+static double bench_run(OFC_BOOL fast, OFC_INT threads)
+{
+  pthread_t *workers ;
+  OFC_UINT64 start ;
+  OFC_UINT64 elapsed ;
+  OFC_INT index ;
+  double ret ;
+
+  bench_use_fast = fast ;
+  bench_count = 0 ;
+  workers = malloc (sizeof (pthread_t) * threads) ;
+  pthread_barrier_init (&bench_start, NULL, threads + 1) ;
+  for (index = 0 ; index < threads ; index++)
+    pthread_create (&workers[index], NULL, bench_thread, NULL) ;
+
+  /*
+   * No worker can start until we reach the barrier, so take the time
+   * first or a quick run can be over before we read the clock
+   */
+  start = bench_now() ;
+  pthread_barrier_wait (&bench_start) ;
+  for (index = 0 ; index < threads ; index++)
+    pthread_join (workers[index], NULL) ;
+  elapsed = bench_now() - start ;
+
+  pthread_barrier_destroy (&bench_start) ;
+  free (workers) ;
+
+  ret = (double) elapsed / ((double) threads * bench_pairs) ;
+  if (bench_count != (OFC_UINT64) threads * bench_pairs)
+    ret = -1.0 ;
+  return (ret) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_INT threads ;
+  double fast ;
+  double recursive ;
+  int ret ;
+
+  threads = BENCH_THREADS ;
+  bench_pairs = BENCH_PAIRS ;
+  if (argc > 1)
+    threads = atoi (argv[1]) ;
+  if (argc > 2)
+    bench_pairs = atoi (argv[2]) ;
+  if (threads < 1 || bench_pairs < 1)
+    {
+      printf ("usage: %s [threads [pairs per thread]]\n", argv[0]) ;
+      return (1) ;
+    }
+
+  ofc_framework_init() ;
+  bench_lock = ofc_lock_init() ;
+
+  /*
+   * Once for warm up
+   */
+  bench_run(OFC_TRUE, threads) ;
+  fast = bench_run(OFC_TRUE, threads) ;
+  recursive = bench_run(OFC_FALSE, threads) ;
+
+  ret = 0 ;
+  if (fast < 0 || recursive < 0)
+    {
+      printf ("Lost updates under a lock\n") ;
+      ret = 1 ;
+    }
+  else
+    printf ("%d threads, %d pairs each: fast %.1f ns, recursive %.1f ns "
+	    "per lock/unlock\n", threads, bench_pairs, fast, recursive) ;
+
+  ofc_lock_destroy(bench_lock) ;
+  ofc_framework_destroy() ;
+  return (ret) ;
+}
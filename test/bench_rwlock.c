@@ -0,0 +1,210 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ofc/types.h"
+#include "ofc/lock.h"
+#include "ofc/framework.h"
+
+#include "ofc_android/lock_android.h"
+
+/*
+ * Read scaling of the reader-writer lock.  Reader threads each take
+ * the lock for reading a fixed number of times while writer threads
+ * take it for writing until the readers are done.  The number of
+ * readers doubles up to the count asked for, and each step is run
+ * with the reader-writer lock and then with ofc_lock for comparison.
+ *
+ *   bench_rwlock [readers [writers [reads per reader]]]
+ */
+#define BENCH_READERS 4
+#define BENCH_WRITERS 0
+#define BENCH_READS 1000000
+
+typedef enum
+  {
+    BENCH_RWLOCK,
+    BENCH_EXCLUSIVE
+  } BENCH_LOCK_TYPE ;
+
+static OFC_RWLOCK *bench_rwlock ;
+static OFC_LOCK bench_lock ;
+static BENCH_LOCK_TYPE bench_type ;
+static OFC_INT bench_reads ;
+static OFC_INT bench_running ;
+static OFC_UINT64 bench_writes ;
+static OFC_UINT32 bench_torn ;
+static pthread_barrier_t bench_start ;
+/*
+ * Writers keep these equal.  A reader that sees them differ got in
+ * alongside a writer.
+ */
+static volatile OFC_UINT64 bench_first ;
+static volatile OFC_UINT64 bench_second ;
+
+static OFC_UINT64 bench_now(OFC_VOID)
+{
+  struct timespec now ;
+
+  clock_gettime (CLOCK_MONOTONIC, &now) ;
+  return ((OFC_UINT64) now.tv_sec * 1000000000 + now.tv_nsec) ;
+}
+
+static OFC_VOID *bench_reader(OFC_VOID *arg)
+{
+  OFC_INT read ;
+  OFC_BOOL torn ;
+
+  torn = OFC_FALSE ;
+  pthread_barrier_wait (&bench_start) ;
+  for (read = 0 ; read < bench_reads ; read++)
+    {
+      if (bench_type == BENCH_RWLOCK)
+	{
+	  ofc_rwlock_read(bench_rwlock) ;
+	  if (bench_first != bench_second)
+	    torn = OFC_TRUE ;
+	  ofc_rwlock_read_unlock(bench_rwlock) ;
+	}
+      else
+	{
+	  ofc_lock (bench_lock) ;
+	  if (bench_first != bench_second)
+	    torn = OFC_TRUE ;
+	  ofc_unlock (bench_lock) ;
+	}
+    }
+  if (torn)
+    __atomic_add_fetch (&bench_torn, 1, __ATOMIC_RELAXED) ;
+  __atomic_sub_fetch (&bench_running, 1, __ATOMIC_RELEASE) ;
+  return (OFC_NULL) ;
+}
+
+static OFC_VOID *bench_writer(OFC_VOID *arg)
+{
+  OFC_UINT64 writes ;
+
+  writes = 0 ;
+  pthread_barrier_wait (&bench_start) ;
+  while (__atomic_load_n (&bench_running, __ATOMIC_ACQUIRE) > 0)
+    {
+      if (bench_type == BENCH_RWLOCK)
+	{
+	  ofc_rwlock_write(bench_rwlock) ;
+	  bench_first++ ;
+	  bench_second++ ;
+	  ofc_rwlock_write_unlock(bench_rwlock) ;
+	}
+      else
+	{
+	  ofc_lock (bench_lock) ;
+	  bench_first++ ;
+	  bench_second++ ;
+	  ofc_unlock (bench_lock) ;
+	}
+      writes++ ;
+    }
+  __atomic_add_fetch (&bench_writes, writes, __ATOMIC_RELAXED) ;
+  return (OFC_NULL) ;
+}
+
+/*
+ * Returns millions of reads per second across all readers
+ */
+static double bench_run(BENCH_LOCK_TYPE type, OFC_INT readers,
+			OFC_INT writers)
+{
+  pthread_t *threads ;
+  OFC_UINT64 start ;
+  OFC_UINT64 elapsed ;
+  OFC_INT index ;
+
+  bench_type = type ;
+  bench_running = readers ;
+  bench_writes = 0 ;
+  threads = malloc (sizeof (pthread_t) * (readers + writers)) ;
+  pthread_barrier_init (&bench_start, NULL, readers + writers + 1) ;
+  for (index = 0 ; index < readers ; index++)
+    pthread_create (&threads[index], NULL, bench_reader, NULL) ;
+  for (index = readers ; index < readers + writers ; index++)
+    pthread_create (&threads[index], NULL, bench_writer, NULL) ;
+
+  /*
+   * No reader can start until we reach the barrier, so take the time
+   * first or a quick run can be over before we read the clock
+   */
+  start = bench_now() ;
+  pthread_barrier_wait (&bench_start) ;
+  for (index = 0 ; index < readers ; index++)
+    pthread_join (threads[index], NULL) ;
+  elapsed = bench_now() - start ;
+  for (index = readers ; index < readers + writers ; index++)
+    pthread_join (threads[index], NULL) ;
+
+  pthread_barrier_destroy (&bench_start) ;
+  free (threads) ;
+
+  return ((double) readers * bench_reads * 1000 / elapsed) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_INT readers ;
+  OFC_INT writers ;
+  OFC_INT step ;
+  OFC_UINT64 writes ;
+  double shared ;
+  double exclusive ;
+
+  readers = BENCH_READERS ;
+  writers = BENCH_WRITERS ;
+  bench_reads = BENCH_READS ;
+  if (argc > 1)
+    readers = atoi (argv[1]) ;
+  if (argc > 2)
+    writers = atoi (argv[2]) ;
+  if (argc > 3)
+    bench_reads = atoi (argv[3]) ;
+  if (readers < 1 || writers < 0 || bench_reads < 1)
+    {
+      printf ("usage: %s [readers [writers [reads per reader]]]\n",
+	      argv[0]) ;
+      return (1) ;
+    }
+
+  ofc_framework_init() ;
+  bench_rwlock = ofc_rwlock_init() ;
+  bench_lock = ofc_lock_init() ;
+
+  printf ("%d writers, %d reads per reader, millions of reads per "
+	  "second\n", writers, bench_reads) ;
+  printf ("readers    rwlock    ofc_lock    writes\n") ;
+  step = 0 ;
+  while (step < readers)
+    {
+      step = step * 2 ;
+      if (step == 0)
+	step = 1 ;
+      if (step > readers)
+	step = readers ;
+      shared = bench_run(BENCH_RWLOCK, step, writers) ;
+      writes = bench_writes ;
+      exclusive = bench_run(BENCH_EXCLUSIVE, step, writers) ;
+      printf ("%7d %9.1f %11.1f %9llu\n", step, shared, exclusive,
+	      (unsigned long long) writes) ;
+    }
+
+  ofc_lock_destroy(bench_lock) ;
+  ofc_rwlock_destroy(bench_rwlock) ;
+  ofc_framework_destroy() ;
+
+  if (bench_torn != 0)
+    printf ("%u readers ran alongside a writer\n", bench_torn) ;
+  return (bench_torn != 0) ;
+}
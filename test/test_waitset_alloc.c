@@ -0,0 +1,107 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#include <stdio.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/event.h"
+#include "ofc/waitset.h"
+#include "ofc/framework.h"
+#include "ofc/heap.h"
+
+/*
+ * A wait set in a steady state must not allocate.  Registrations are
+ * recycled and the poll arrays only grow, so once every handle has
+ * been waited on, waiting again allocates nothing.
+ */
+#define TEST_EVENTS 16
+#define TEST_WARMUP 64
+#define TEST_WAITS 10000
+
+OFC_VOID *__real_ofc_malloc(OFC_SIZET size) ;
+OFC_VOID *__real_ofc_realloc(OFC_VOID *mem, OFC_SIZET size) ;
+
+static OFC_UINT32 test_allocs ;
+
+OFC_VOID *__wrap_ofc_malloc(OFC_SIZET size)
+{
+  __atomic_add_fetch (&test_allocs, 1, __ATOMIC_RELAXED) ;
+  return (__real_ofc_malloc(size)) ;
+}
+
+OFC_VOID *__wrap_ofc_realloc(OFC_VOID *mem, OFC_SIZET size)
+{
+  __atomic_add_fetch (&test_allocs, 1, __ATOMIC_RELAXED) ;
+  return (__real_ofc_realloc(mem, size)) ;
+}
+
+/*
+ * Set each event in turn and wait for it.  Returns the number of
+ * waits that didn't report the event just set.
+ */
+static OFC_INT test_waits(OFC_HANDLE hWaitSet, OFC_HANDLE *events,
+			  OFC_INT count)
+{
+  OFC_INT index ;
+  OFC_INT missed ;
+
+  missed = 0 ;
+  for (index = 0 ; index < count ; index++)
+    {
+      ofc_event_set(events[index % TEST_EVENTS]) ;
+      if (ofc_waitset_wait(hWaitSet) != events[index % TEST_EVENTS])
+	missed++ ;
+    }
+  return (missed) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_HANDLE hWaitSet ;
+  OFC_HANDLE events[TEST_EVENTS] ;
+  OFC_UINT32 allocs ;
+  OFC_INT missed ;
+  OFC_INT index ;
+  int ret ;
+
+  ofc_framework_init() ;
+
+  hWaitSet = ofc_waitset_create() ;
+  for (index = 0 ; index < TEST_EVENTS ; index++)
+    {
+      events[index] = ofc_event_create(OFC_EVENT_AUTO) ;
+      ofc_waitset_add(hWaitSet, OFC_HANDLE_NULL, events[index]) ;
+    }
+
+  missed = test_waits(hWaitSet, events, TEST_WARMUP) ;
+
+  allocs = __atomic_load_n (&test_allocs, __ATOMIC_RELAXED) ;
+  missed += test_waits(hWaitSet, events, TEST_WAITS) ;
+  allocs = __atomic_load_n (&test_allocs, __ATOMIC_RELAXED) - allocs ;
+
+  ret = 0 ;
+  if (missed != 0)
+    {
+      printf ("%d waits missed their event\n", missed) ;
+      ret = 1 ;
+    }
+  if (allocs != 0)
+    {
+      printf ("%u allocations in %d steady state waits\n", allocs,
+	      TEST_WAITS) ;
+      ret = 1 ;
+    }
+
+  for (index = 0 ; index < TEST_EVENTS ; index++)
+    {
+      ofc_waitset_remove(hWaitSet, events[index]) ;
+      ofc_event_destroy(events[index]) ;
+    }
+  ofc_waitset_destroy(hWaitSet) ;
+  ofc_framework_destroy() ;
+
+  return (ret) ;
+}
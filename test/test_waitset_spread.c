@@ -0,0 +1,115 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#include <stdio.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/net.h"
+#include "ofc/socket.h"
+#include "ofc/waitset.h"
+#include "ofc/framework.h"
+
+/*
+ * Handles that are always ready must all be served.  Each socket has a
+ * datagram queued that is never read, so every wait finds all of them
+ * ready.  Waits must spread across the sockets rather than favouring
+ * the ones registered first.
+ */
+#define TEST_SOCKETS 8
+#define TEST_PORT 45100
+#define TEST_WAITS (TEST_SOCKETS * 1000)
+/*
+ * Largest allowed ratio of the most served socket to the least
+ */
+#define TEST_SPREAD 2
+
+int main(int argc, char **argv)
+{
+  OFC_HANDLE hWaitSet ;
+  OFC_HANDLE sockets[TEST_SOCKETS] ;
+  OFC_INT served[TEST_SOCKETS] ;
+  OFC_IPADDR ip ;
+  OFC_HANDLE hReady ;
+  OFC_INT index ;
+  OFC_INT wait ;
+  OFC_INT most ;
+  OFC_INT least ;
+  OFC_CHAR datagram ;
+  int ret ;
+
+  ofc_framework_init() ;
+
+  ip.ip_version = OFC_FAMILY_IP ;
+  ip.u.ipv4.addr = OFC_INADDR_LOOPBACK ;
+  datagram = 0 ;
+
+  ret = 0 ;
+  hWaitSet = ofc_waitset_create() ;
+  for (index = 0 ; index < TEST_SOCKETS ; index++)
+    {
+      served[index] = 0 ;
+      sockets[index] = ofc_socket_datagram(&ip, TEST_PORT + index) ;
+      if (sockets[index] == OFC_HANDLE_NULL)
+	{
+	  printf ("Can't create socket on port %d\n", TEST_PORT + index) ;
+	  ret = 1 ;
+	}
+      else
+	{
+	  ofc_socket_enable(sockets[index], OFC_SOCKET_EVENT_READ) ;
+	  ofc_waitset_add(hWaitSet, OFC_HANDLE_NULL, sockets[index]) ;
+	  ofc_socket_sendto(sockets[index], &datagram, sizeof (datagram),
+			    &ip, TEST_PORT + index) ;
+	}
+    }
+
+  for (wait = 0 ; wait < TEST_WAITS && ret == 0 ; wait++)
+    {
+      hReady = ofc_waitset_wait(hWaitSet) ;
+      for (index = 0 ;
+	   index < TEST_SOCKETS && sockets[index] != hReady ;
+	   index++) ;
+      if (index == TEST_SOCKETS)
+	{
+	  printf ("Wait %d returned no socket\n", wait) ;
+	  ret = 1 ;
+	}
+      else
+	served[index]++ ;
+    }
+
+  if (ret == 0)
+    {
+      most = served[0] ;
+      least = served[0] ;
+      for (index = 1 ; index < TEST_SOCKETS ; index++)
+	{
+	  if (served[index] > most)
+	    most = served[index] ;
+	  if (served[index] < least)
+	    least = served[index] ;
+	}
+      if (least == 0 || most > least * TEST_SPREAD)
+	{
+	  printf ("Sockets served between %d and %d times in %d waits\n",
+		  least, most, TEST_WAITS) ;
+	  ret = 1 ;
+	}
+    }
+
+  for (index = 0 ; index < TEST_SOCKETS ; index++)
+    {
+      if (sockets[index] != OFC_HANDLE_NULL)
+	{
+	  ofc_waitset_remove(hWaitSet, sockets[index]) ;
+	  ofc_socket_destroy(sockets[index]) ;
+	}
+    }
+  ofc_waitset_destroy(hWaitSet) ;
+  ofc_framework_destroy() ;
+
+  return (ret) ;
+}